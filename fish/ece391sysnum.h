@@ -12,4 +12,9 @@
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
 
+/* Read only time page the kernel maps into every process */
+#define ECE391_TIME_PAGE 0xFFFFF000
+#define ECE391_TIME_FEATURES (ECE391_TIME_PAGE + 32)
+#define ECE391_FEAT_SYSENTER 0x1
+
 #endif /* ECE391SYSNUM_H */
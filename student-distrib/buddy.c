@@ -0,0 +1,220 @@
+/* buddy.c - physical page frame allocator (buddy system)
+ *
+ * Manages the RAM between the end of the kernel page and the start of
+ * user virtual memory. paging_init maps that range one to one for the
+ * kernel, so a free block keeps its list links in its own first bytes.
+ */
+
+#include "buddy.h"
+#include "lib.h"
+
+// Magic Numbers
+#define BUDDY_BASE          0x800000            // 8 MB, end of the kernel page
+#define BUDDY_LIMIT         0x8000000           // 128 MB, start of user memory
+#define BUDDY_FRAMES        ((BUDDY_LIMIT - BUDDY_BASE) / FRAME_SIZE)
+#define FREE_HEAD           0x80                // frame_state: first frame of a free block
+#define MMAP_AVAILABLE      1
+#define KB                  1024
+#define LOW_MEM_END         0x100000
+#define CHECK_FLAG(flags,bit)   ((flags) & (1 << (bit)))
+
+// header written at the start of every free block
+typedef struct free_block_t {
+    struct free_block_t* next;
+    struct free_block_t* prev;
+} free_block_t;
+
+static free_block_t* free_list[MAX_ORDER + 1];
+// FREE_HEAD | order for the first frame of a free block, 0 for any other frame
+static uint8_t frame_state[BUDDY_FRAMES];
+static uint32_t free_count;
+static uint32_t mem_low;
+
+// Local functions
+static void buddy_add_region(uint32_t base, uint32_t len);
+static void list_push(uint32_t idx, uint32_t order);
+static void list_remove(uint32_t idx, uint32_t order);
+
+/*
+ * buddy_init
+ *   DESCRIPTION: Walks the boot loader memory map and frees every usable
+ *                frame between the end of the boot modules (at least 8 MB)
+ *                and 128 MB. Falls back to mem_upper when there is no map.
+ *                Must run before paging_init, the boot loader tables live
+ *                in low memory that is not mapped once paging is on
+ *   INPUTS: mbi--multiboot information structure
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the free list headers into the free frames
+ */
+void buddy_init(multiboot_info_t* mbi) {
+    memory_map_t* mmap;
+    module_t* mod;
+    uint32_t i;
+
+    memset(free_list, 0, sizeof(free_list));
+    memset(frame_state, 0, sizeof(frame_state));
+    free_count = 0;
+
+    // never hand out the boot modules, the file system lives there
+    mem_low = BUDDY_BASE;
+    if (CHECK_FLAG(mbi->flags, 3)) {
+        mod = (module_t*)mbi->mods_addr;
+        for (i = 0; i < mbi->mods_count; i++, mod++) {
+            if (mod->mod_end > mem_low) mem_low = (mod->mod_end + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+        }
+    }
+
+    if (CHECK_FLAG(mbi->flags, 6)) {
+        for (mmap = (memory_map_t*)mbi->mmap_addr;
+             (uint32_t)mmap < mbi->mmap_addr + mbi->mmap_length;
+             mmap = (memory_map_t*)((uint32_t)mmap + mmap->size + sizeof(mmap->size))) {
+            if (mmap->type != MMAP_AVAILABLE || mmap->base_addr_high != 0) continue;
+            buddy_add_region(mmap->base_addr_low, mmap->length_low);
+        }
+    } else if (CHECK_FLAG(mbi->flags, 0)) {
+        buddy_add_region(LOW_MEM_END, mbi->mem_upper * KB);
+    }
+}
+
+/*
+ * frame_alloc
+ *   DESCRIPTION: Allocates 2^order physically contiguous frames, splitting
+ *                the smallest free block that is large enough
+ *   INPUTS: order--log2 of the number of frames
+ *   OUTPUTS: none
+ *   RETURN VALUE: physical address of the block (the kernel can use it
+ *                 directly), 0 if no block is free
+ *   SIDE EFFECTS: none
+ */
+uint32_t frame_alloc(uint32_t order) {
+    uint32_t flags, cur, idx;
+
+    if (order > MAX_ORDER) return 0;
+
+    cli_and_save(flags);
+    for (cur = order; cur <= MAX_ORDER && free_list[cur] == NULL; cur++);
+    if (cur > MAX_ORDER) {
+        restore_flags(flags);
+        return 0;
+    }
+    idx = ((uint32_t)free_list[cur] - BUDDY_BASE) / FRAME_SIZE;
+    list_remove(idx, cur);
+    // give the upper halves back until the block has the right size
+    while (cur > order) {
+        cur--;
+        list_push(idx + (1 << cur), cur);
+    }
+    free_count -= (1 << order);
+    restore_flags(flags);
+
+    return BUDDY_BASE + idx * FRAME_SIZE;
+}
+
+/*
+ * frame_free
+ *   DESCRIPTION: Frees a block returned by frame_alloc, merging it with its
+ *                buddy for as long as the buddy is free and the same size
+ *   INPUTS: addr--physical address of the block
+ *           order--the order it was allocated with
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void frame_free(uint32_t addr, uint32_t order) {
+    uint32_t flags, idx, buddy;
+
+    if (addr < BUDDY_BASE || addr >= BUDDY_LIMIT || order > MAX_ORDER) return;
+    idx = (addr - BUDDY_BASE) / FRAME_SIZE;
+
+    cli_and_save(flags);
+    free_count += (1 << order);
+    while (order < MAX_ORDER) {
+        buddy = idx ^ (1 << order);
+        if (buddy >= BUDDY_FRAMES || frame_state[buddy] != (FREE_HEAD | order)) break;
+        list_remove(buddy, order);
+        idx &= ~(1 << order);
+        order++;
+    }
+    list_push(idx, order);
+    restore_flags(flags);
+}
+
+/*
+ * frames_free
+ *   DESCRIPTION: Gets the number of free frames
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: free frame count
+ *   SIDE EFFECTS: none
+ */
+uint32_t frames_free(void) {
+    return free_count;
+}
+
+/*
+ * buddy_add_region
+ *   DESCRIPTION: Frees the part of a usable memory range that lies inside
+ *                the managed window, in the largest aligned blocks it fits
+ *   INPUTS: base--physical start of the range
+ *           len--length in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void buddy_add_region(uint32_t base, uint32_t len) {
+    uint32_t end = base + len;
+    uint32_t idx, last, order;
+
+    if (end < base) end = BUDDY_LIMIT;
+    if (base < mem_low) base = mem_low;
+    if (end > BUDDY_LIMIT) end = BUDDY_LIMIT;
+    if (base >= end) return;
+
+    idx = (base - BUDDY_BASE + FRAME_SIZE - 1) / FRAME_SIZE;
+    last = (end - BUDDY_BASE) / FRAME_SIZE;
+    while (idx < last) {
+        for (order = MAX_ORDER; order > 0; order--) {
+            if ((idx & ((1 << order) - 1)) == 0 && idx + (1 << order) <= last) break;
+        }
+        frame_free(BUDDY_BASE + idx * FRAME_SIZE, order);
+        idx += (1 << order);
+    }
+}
+
+/*
+ * list_push
+ *   DESCRIPTION: Puts a free block at the head of its free list
+ *   INPUTS: idx--first frame of the block
+ *           order--size of the block
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the list header into the block
+ */
+static void list_push(uint32_t idx, uint32_t order) {
+    free_block_t* block = (free_block_t*)(BUDDY_BASE + idx * FRAME_SIZE);
+
+    block->prev = NULL;
+    block->next = free_list[order];
+    if (free_list[order] != NULL) free_list[order]->prev = block;
+    free_list[order] = block;
+    frame_state[idx] = FREE_HEAD | order;
+}
+
+/*
+ * list_remove
+ *   DESCRIPTION: Takes a free block off its free list
+ *   INPUTS: idx--first frame of the block
+ *           order--size of the block
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void list_remove(uint32_t idx, uint32_t order) {
+    free_block_t* block = (free_block_t*)(BUDDY_BASE + idx * FRAME_SIZE);
+
+    if (block->prev != NULL) block->prev->next = block->next;
+    else free_list[order] = block->next;
+    if (block->next != NULL) block->next->prev = block->prev;
+    frame_state[idx] = 0;
+}
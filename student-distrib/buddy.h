@@ -0,0 +1,22 @@
+/* buddy.h - physical page frame allocator (buddy system)
+ */
+
+#ifndef _BUDDY_H
+#define _BUDDY_H
+
+#include "types.h"
+#include "multiboot.h"
+
+#define FRAME_SIZE          0x1000
+#define MAX_ORDER           10                  // 2^10 frames = 4 MB
+
+/* Hand the usable RAM described by the boot loader to the allocator */
+void buddy_init(multiboot_info_t* mbi);
+/* Allocate 2^order contiguous frames */
+uint32_t frame_alloc(uint32_t order);
+/* Free 2^order contiguous frames */
+void frame_free(uint32_t addr, uint32_t order);
+/* Number of free frames */
+uint32_t frames_free(void);
+
+#endif
@@ -0,0 +1,235 @@
+/* clock.c - monotonic nanosecond clock. The TSC rate is measured against
+ * PIT channel 2 at boot, cycles become nanoseconds with a multiply and a
+ * shift so nothing needs a 64-bit division. The calibration and the tick
+ * count live in a page every process can read, guarded by a sequence
+ * counter, so user code gets the time without a system call
+ */
+
+#include "clock.h"
+#include "paging.h"
+#include "lib.h"
+
+// Magic Numbers
+#define PIT_CMD_PORT        0x43
+#define PIT_CH2_PORT        0x42
+#define PIT_CH2_MODE0       0xB0        // channel 2, lobyte/hibyte, mode 0
+#define PIT_FREQ            1193182
+#define SPEAKER_PORT        0x61
+#define SPEAKER_GATE2       0x01
+#define SPEAKER_DATA        0x02
+#define SPEAKER_OUT2        0x20
+#define CAL_MS              10
+#define CAL_LATCH           (PIT_FREQ * CAL_MS / 1000)
+#define NS_PER_MS           1000000
+#define NS_PER_SEC          1000000000
+#define CLOCK_SHIFT         22
+#define LOW_BYTE            0xFF
+#define BYTE_SHIFT          8
+#define TIME_PAGE_SIZE      4096
+
+/* The time page, padded to a whole page so no other kernel data is exposed */
+static union {
+    time_page_t t;
+    uint8_t pad[TIME_PAGE_SIZE];
+} time_page __attribute__((aligned(TIME_PAGE_SIZE)));
+static time_page_t* const tp = &time_page.t;
+
+/* Enter and leave an update of the time page, readers retry meanwhile */
+static void write_begin(void);
+static void write_end(void);
+
+/*
+ * clock_init
+ *   DESCRIPTION: Counts TSC cycles while PIT channel 2 runs down CAL_MS
+ *                milliseconds in one shot mode, and derives the factor
+ *                turning cycles into nanoseconds, then maps the time page
+ *                for user space
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: uses PIT channel 2, the speaker stays off
+ */
+void clock_init(void) {
+    uint32_t flags, lo0, hi0, lo1, hi1, tsc_khz, mult;
+
+    cli_and_save(flags);
+    // gate channel 2 on, keep its output off the speaker
+    outb((inb(SPEAKER_PORT) & ~SPEAKER_DATA) | SPEAKER_GATE2, SPEAKER_PORT);
+    outb(PIT_CH2_MODE0, PIT_CMD_PORT);
+    outb(CAL_LATCH & LOW_BYTE, PIT_CH2_PORT);
+    outb(CAL_LATCH >> BYTE_SHIFT, PIT_CH2_PORT);
+
+    rdtsc(lo0, hi0);
+    while(!(inb(SPEAKER_PORT) & SPEAKER_OUT2));
+    rdtsc(lo1, hi1);
+
+    // a CAL_MS window is far below 2^32 cycles, the low halves suffice
+    tsc_khz = (lo1 - lo0) / CAL_MS;
+    if(tsc_khz == 0) tsc_khz = 1;
+
+    // mult = (NS_PER_MS << CLOCK_SHIFT) / tsc_khz, a 64 by 32 bit divide
+    asm volatile("divl %4"
+                 : "=a"(mult), "=d"(lo0)
+                 : "a"((uint32_t)((uint64_t)NS_PER_MS << CLOCK_SHIFT)),
+                   "d"((uint32_t)(((uint64_t)NS_PER_MS << CLOCK_SHIFT) >> 32)), "r"(tsc_khz)
+                 : "cc");
+
+    write_begin();
+    tp->tsc_khz = tsc_khz;
+    tp->mult = mult;
+    tp->shift = CLOCK_SHIFT;
+    tp->base_lo = lo1;
+    tp->base_hi = hi1;
+    write_end();
+    map_time_page((uint32_t)tp);
+    restore_flags(flags);
+}
+
+/*
+ * clock_ns
+ *   DESCRIPTION: Reads the monotonic clock. The 64-bit cycle count is
+ *                scaled a half at a time so every product fits 64 bits
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: nanoseconds since clock_init
+ *   SIDE EFFECTS: none
+ */
+uint64_t clock_ns(void) {
+    uint32_t lo, hi;
+    uint64_t cycles;
+
+    rdtsc(lo, hi);
+    cycles = (((uint64_t)hi << 32) | lo) - (((uint64_t)tp->base_hi << 32) | tp->base_lo);
+    lo = (uint32_t)cycles;
+    hi = (uint32_t)(cycles >> 32);
+
+    return (((uint64_t)lo * tp->mult) >> CLOCK_SHIFT) + (((uint64_t)hi * tp->mult) << (32 - CLOCK_SHIFT));
+}
+
+/*
+ * ns_to_timespec
+ *   DESCRIPTION: Splits nanoseconds with a single divl, the seconds fit
+ *                32 bits for the next 136 years
+ *   INPUTS: ns--nanoseconds
+ *           ts--where to put seconds and nanoseconds
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void ns_to_timespec(uint64_t ns, timespec_t* ts) {
+    asm volatile("divl %4"
+                 : "=a"(ts->sec), "=d"(ts->nsec)
+                 : "a"((uint32_t)ns), "d"((uint32_t)(ns >> 32)), "r"(NS_PER_SEC)
+                 : "cc");
+}
+
+/*
+ * clock_jiffies
+ *   DESCRIPTION: Converts the clock into PIT ticks, so the tick count
+ *                stays right while the PIT is stopped. The high word is
+ *                divided first and its remainder carried into the low
+ *                one, so divl never overflows. The count wraps at 32 bits
+ *                like jiffies
+ *   INPUTS: none
+ *   OUTPUTS: into--where to put the nanoseconds since the tick started,
+ *                  may be NULL
+ *   RETURN VALUE: ticks since clock_init, needs clock_set_hz first
+ *   SIDE EFFECTS: none
+ */
+uint32_t clock_jiffies(uint32_t* into) {
+    uint64_t ns = clock_ns();
+    uint32_t tick_ns = NS_PER_SEC / tp->hz;
+    uint32_t ticks, rem;
+
+    // the high word of the quotient is dropped, only its remainder counts
+    asm volatile("divl %4"
+                 : "=a"(ticks), "=d"(rem)
+                 : "a"((uint32_t)(ns >> 32)), "d"(0), "r"(tick_ns)
+                 : "cc");
+    asm volatile("divl %4"
+                 : "=a"(ticks), "=d"(rem)
+                 : "a"((uint32_t)ns), "d"(rem), "r"(tick_ns)
+                 : "cc");
+    if(into != NULL) *into = rem;
+    return ticks;
+}
+
+/*
+ * clock_set_features
+ *   DESCRIPTION: Publishes the features user code may rely on, so the
+ *                system call stubs learn from the kernel whether SYSENTER
+ *                was set up rather than from CPUID
+ *   INPUTS: features--TIME_FEAT_* flags
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void clock_set_features(uint32_t features) {
+    uint32_t flags;
+
+    cli_and_save(flags);
+    write_begin();
+    tp->features = features;
+    write_end();
+    restore_flags(flags);
+}
+
+/*
+ * clock_set_hz
+ *   DESCRIPTION: Publishes the rate the PIT interrupts at
+ *   INPUTS: hz--ticks per second
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void clock_set_hz(uint32_t hz) {
+    uint32_t flags;
+
+    cli_and_save(flags);
+    write_begin();
+    tp->hz = hz;
+    write_end();
+    restore_flags(flags);
+}
+
+/*
+ * clock_tick
+ *   DESCRIPTION: Publishes the tick count, runs in the PIT interrupt so
+ *                there is a single writer
+ *   INPUTS: jiffies--ticks since boot
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void clock_tick(uint32_t jiffies) {
+    write_begin();
+    tp->jiffies = jiffies;
+    write_end();
+}
+
+/*
+ * write_begin
+ *   DESCRIPTION: Makes seq odd before the page changes. x86 keeps stores
+ *                in order, the compiler is kept from moving them
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void write_begin(void) {
+    tp->seq++;
+    asm volatile("": : :"memory");
+}
+
+/*
+ * write_end
+ *   DESCRIPTION: Makes seq even again once the page is consistent
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void write_end(void) {
+    asm volatile("": : :"memory");
+    tp->seq++;
+}
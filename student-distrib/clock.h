@@ -0,0 +1,52 @@
+/* clock.h - monotonic nanosecond clock from the TSC, also published to
+ * user space through a read only time page
+ */
+
+#ifndef _CLOCK_H
+#define _CLOCK_H
+
+#include "types.h"
+
+#define TIME_PAGE_ADDR          0xFFFFF000  // where every process sees the time page
+#define TIME_FEAT_SYSENTER      0x1         // SYSENTER is set up, user stubs may use it
+
+#ifndef ASM
+
+// Time as seen by gettime
+typedef struct timespec_t {
+	uint32_t sec;
+	uint32_t nsec;
+} timespec_t;
+
+// Layout of the time page, user code reads it between two equal even
+// values of seq and computes the clock as clock_ns does
+typedef struct time_page_t {
+	volatile uint32_t seq;          // odd while the kernel updates the page
+	volatile uint32_t jiffies;      // PIT ticks since boot
+	uint32_t hz;                    // PIT ticks per second
+	uint32_t tsc_khz;               // TSC rate in kHz
+	uint32_t mult;                  // ns = (cycles * mult) >> shift
+	uint32_t shift;
+	uint32_t base_lo;               // TSC at calibration, the clock counts from there
+	uint32_t base_hi;
+	uint32_t features;              // TIME_FEAT_* the kernel offers user code
+} time_page_t;
+
+/* Measure the TSC against PIT channel 2 */
+void clock_init(void);
+/* Nanoseconds since clock_init */
+uint64_t clock_ns(void);
+/* Split nanoseconds into seconds and nanoseconds */
+void ns_to_timespec(uint64_t ns, timespec_t* ts);
+/* Ticks of the published PIT rate since clock_init */
+uint32_t clock_jiffies(uint32_t* into);
+/* Publish what the kernel offers user code in the time page */
+void clock_set_features(uint32_t features);
+/* Publish the PIT rate in the time page */
+void clock_set_hz(uint32_t hz);
+/* Publish the tick count in the time page, called from the PIT interrupt */
+void clock_tick(uint32_t jiffies);
+
+#endif
+
+#endif
@@ -2,10 +2,35 @@
 #include "lib.h"
 #include "syscall.h"
 #include "terminal.h"
+#include "klog.h"
+
+// magic numbers for the name index
+#define INDEX_SIZE      128                 // power of two, > 2 * DIR_ENTRIES_NUMS
+#define INDEX_MASK      (INDEX_SIZE - 1)
+#define NEG_CACHE_SIZE  8                   // power of two
+#define NEG_CACHE_MASK  (NEG_CACHE_SIZE - 1)
+#define FNV_OFFSET      2166136261u
+#define FNV_PRIME       16777619u
+
+// negative lookup cache entry: a name we already know is not in the directory
+typedef struct neg_entry_t{
+    uint32_t hash;
+    uint32_t len;
+    uint8_t name[NAME_LENGTH];
+}neg_entry_t;
 
 //global variable
 boot_block_t* bootblock;
 static int32_t cur_dir;
+// open addressing hash table of directory entry index + 1 (0 is empty)
+static uint8_t name_index[INDEX_SIZE];
+// direct mapped cache of failed lookups, the file system is read only so it never goes stale
+static neg_entry_t neg_cache[NEG_CACHE_SIZE];
+
+// local functions
+static uint32_t name_key_len(const uint8_t* name);
+static uint32_t name_hash(const uint8_t* name, uint32_t len);
+static void build_name_index(void);
 
 /*
  * terminal_init
@@ -20,7 +45,68 @@ static int32_t cur_dir;
 void load_filesystem(boot_block_t* start){
     bootblock = start;
     cur_dir = 0;
-    printf("file system: 0x%x\n", bootblock);
+    build_name_index();
+    klog("file system: 0x%x\n", bootblock);
+}
+
+/*
+ * name_key_len
+ *   DESCRIPTION: the number of characters of a name that take part in lookups,
+ *                names are not null terminated when they fill all 32 bytes and
+ *                only the first NAME_LENGTH - 1 characters are compared
+ *   INPUTS: name -- the file name
+ *   OUTPUTS: none
+ *   RETURN VALUE: the key length
+ *   SIDE EFFECTS: none
+ */
+static uint32_t name_key_len(const uint8_t* name){
+    uint32_t len = 0;
+    while (len < NAME_LENGTH - 1 && name[len] != '\0') {
+        len++;
+    }
+    return len;
+}
+
+/*
+ * name_hash
+ *   DESCRIPTION: FNV-1a hash of the first len characters of a name
+ *   INPUTS: name -- the file name
+ *           len -- the key length
+ *   OUTPUTS: none
+ *   RETURN VALUE: the hash value
+ *   SIDE EFFECTS: none
+ */
+static uint32_t name_hash(const uint8_t* name, uint32_t len){
+    uint32_t i;
+    uint32_t hash = FNV_OFFSET;
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ name[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+/*
+ * build_name_index
+ *   DESCRIPTION: build the hash index over the directory entries of the boot block
+ *                and empty the negative lookup cache
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: overwrites name_index and neg_cache
+ */
+static void build_name_index(void){
+    uint32_t i, len, slot;
+    memset(name_index, 0, sizeof(name_index));
+    memset(neg_cache, 0, sizeof(neg_cache));
+    for (i = 0; i < bootblock -> dir_entries_n && i < DIR_ENTRIES_NUMS; i++) {
+        len = name_key_len(bootblock -> dir_entries[i].file_name);
+        slot = name_hash(bootblock -> dir_entries[i].file_name, len) & INDEX_MASK;
+        // linear probing, the table is never more than half full
+        while (name_index[slot] != 0) {
+            slot = (slot + 1) & INDEX_MASK;
+        }
+        name_index[slot] = i + 1;
+    }
 }
 
 /*
@@ -33,32 +119,35 @@ void load_filesystem(boot_block_t* start){
  *   SIDE EFFECTS: dentry changed by the thing we want
  */
 int32_t read_dentry_by_name (const uint8_t* fname, dentry_t* dentry){
-    int i;
-    int length = 0;
-    int fname_len = 0;
+    uint32_t fname_len, hash, slot, idx;
+    neg_entry_t* neg;
     // if null pointer, fail
     if (fname == NULL) {
         return -1;
     }
-    // put the length in the variabe
-    fname_len = strlen((int8_t *) fname);
-    if(fname_len >= NAME_LENGTH)
-        fname_len = NAME_LENGTH - 1;
-    
-    for (i = 0; i < bootblock -> dir_entries_n; i++) {
-        length = strlen((int8_t *) bootblock->dir_entries[i].file_name);
-        if (length == NAME_LENGTH + 1) {
-            length = NAME_LENGTH - 1;
-        }
-        if (strncmp((int8_t*) fname, (int8_t*) bootblock -> dir_entries[i].file_name, fname_len) == 0 && fname_len == length) {
-                //copy the string
-            strcpy((int8_t *) dentry -> file_name, (int8_t *) bootblock -> dir_entries[i].file_name);
-                // file type and inode changed
-            dentry -> file_type = bootblock -> dir_entries[i].file_type;
-            dentry -> inode = bootblock -> dir_entries[i].inode;
-            return 0;
+    // only the first NAME_LENGTH - 1 characters are significant
+    fname_len = name_key_len(fname);
+    hash = name_hash(fname, fname_len);
+
+    // names that already failed once fail without probing the index
+    neg = &neg_cache[hash & NEG_CACHE_MASK];
+    if (neg -> len == fname_len && neg -> hash == hash &&
+        strncmp((int8_t*) fname, (int8_t*) neg -> name, fname_len) == 0) {
+        return -1;
+    }
+
+    for (slot = hash & INDEX_MASK; name_index[slot] != 0; slot = (slot + 1) & INDEX_MASK) {
+        idx = name_index[slot] - 1;
+        if (name_key_len(bootblock -> dir_entries[idx].file_name) == fname_len &&
+            strncmp((int8_t*) fname, (int8_t*) bootblock -> dir_entries[idx].file_name, fname_len) == 0) {
+            return read_dentry_by_index(idx, dentry);
         }
     }
+
+    // remember the miss, replacing whatever shared its cache slot
+    neg -> hash = hash;
+    neg -> len = fname_len;
+    strncpy((int8_t*) neg -> name, (int8_t*) fname, fname_len);
     return -1;
 }
 
@@ -76,8 +165,8 @@ int32_t read_dentry_by_index (uint32_t index, dentry_t* dentry){
     if (index < 0 || index >= bootblock -> dir_entries_n) {
         return -1;
     }
-    // do the appropriate change in the dentry
-    strcpy((int8_t *) dentry -> file_name, (int8_t *) bootblock -> dir_entries[index].file_name);
+    // do the appropriate change in the dentry, names filling all 32 bytes have no terminator
+    strncpy((int8_t *) dentry -> file_name, (int8_t *) bootblock -> dir_entries[index].file_name, NAME_LENGTH);
     dentry -> file_type = bootblock -> dir_entries[index].file_type;
     dentry -> inode = bootblock -> dir_entries[index].inode;
     
@@ -87,13 +176,15 @@ int32_t read_dentry_by_index (uint32_t index, dentry_t* dentry){
 /*
  * read_data
  *   DESCRIPTION: reading up to length bytes starting from position offset in the file with inode
- *   number inode and returning the number of bytes read and placed in the buffer
+ *   number inode and returning the number of bytes read and placed in the buffer. Each data
+ *   block is looked up once and copied as a whole span, runs of physically adjacent data
+ *   blocks are copied together with a single memcpy
  *   INPUTS: inode --- inode number
  *           offset --- the offset of the file system
  *           buf --- to be placed in the buffer
  *           length --- length if the bytes
  *   OUTPUTS: none
- *   RETURN VALUE: bytes read and placed
+ *   RETURN VALUE: bytes read and placed, -1 on a bad inode or data block number
  *   SIDE EFFECTS: put the thing we want in the buffer
  */
 int32_t read_data (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length){
@@ -102,34 +193,52 @@ int32_t read_data (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t lengt
         return -1;
     }
     
-    uint32_t i;
-    uint32_t* datastart;
+    uint8_t* datastart;
+    uint8_t* src;
     inode_t* inode_go;
-    uint32_t inode_length, index;
+    uint32_t count, copied, run, blk, blk_off, index;
     
     //start address of the datablock
-    datastart = (uint32_t*)((uint32_t)bootblock + (bootblock -> inodes_n + 1) * BLOCK_SIZE);
+    datastart = (uint8_t*)((uint32_t)bootblock + (bootblock -> inodes_n + 1) * BLOCK_SIZE);
     // the specific inode address
     inode_go = (inode_t*)((uint32_t)bootblock + (inode + 1) * BLOCK_SIZE);
-    //the length of the inode
-    inode_length = inode_go -> length;
     //error condition
-    if (offset >= inode_length) {
+    if (offset >= inode_go -> length) {
         return 0;
     }
-    for (i = 0; i < length; i++) {
-        if (offset + i >= inode_length) {
-            break;
+    // never read past the end of the file
+    count = inode_go -> length - offset;
+    if (count > length) {
+        count = length;
+    }
+    
+    blk = offset / BLOCK_SIZE;
+    blk_off = offset % BLOCK_SIZE;
+    for (copied = 0; copied < count; copied += run) {
+        index = inode_go -> block[blk];
+        if (index >= bootblock -> data_blocks) {
+            return -1;
+        }
+        // the rest of this block, or what is left to read
+        src = datastart + index * BLOCK_SIZE + blk_off;
+        run = BLOCK_SIZE - blk_off;
+        if (run > count - copied) {
+            run = count - copied;
+        }
+        // extend the run while the next data block follows this one in the image
+        while (copied + run < count && inode_go -> block[blk + 1] == index + 1 && index + 1 < bootblock -> data_blocks) {
+            blk++;
+            index++;
+            run += (count - copied - run < BLOCK_SIZE) ? count - copied - run : BLOCK_SIZE;
         }
-        // the index of data
-        index = *(uint32_t *)((uint32_t) inode_go + (1 + (i + offset)/BLOCK_SIZE) * FOUR);
-        // load the right thing in the buffer
-        buf[i] = *(uint8_t *)((uint32_t) datastart + index * BLOCK_SIZE + (i + offset) % BLOCK_SIZE);
+        memcpy(buf + copied, src, run);
+        blk++;
+        blk_off = 0;
     }
     // end with null terminator
-    if(i < length) buf[i] = '\0';
+    if(copied < length) buf[copied] = '\0';
     
-    return i;
+    return copied;
     
 }
 
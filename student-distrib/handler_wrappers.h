@@ -11,8 +11,16 @@ extern void pit_irq(void);
 extern void keyboard_irq(void);
 /* Wrapper for RTC */
 extern void rtc_irq(void);
+/* Wrapper for COM1 */
+extern void serial_irq(void);
 /* Wrapper for system calls */
 extern void systemcall_wrapper(void);
+/* Wrapper for page faults */
+extern void page_fault_wrapper(void);
+/* Entry point of SYSENTER system calls */
+extern void sysenter_entry(void);
+/* Stack SYSENTER switches to before loading tss.esp0 */
+extern uint32_t sysenter_stack[];
 
 #endif
 
@@ -98,7 +98,7 @@ disable_irq(uint32_t irq_num)
     if (irq_num & MAX_PIC)
     {
         //slave PIC:
-        mask = (1 << (irq_num & MAX_PIC));
+        mask = (1 << (irq_num - MAX_PIC));
         slave_mask |= mask;
         // write the mask to slave port data
         outb(slave_mask, SLAVE_8259_PORT_DAT);
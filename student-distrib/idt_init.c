@@ -4,6 +4,8 @@
 #include "keyboard.h"
 #include "rtc.h"
 #include "handler_wrappers.h"
+#include "syscall.h"
+#include "klog.h"
 
 #define EXP_END      0x1F
 #define INT_START    0x20
@@ -11,6 +13,8 @@
 #define INT_PIT      0x20
 #define INT_KBD      0x21
 #define INT_RTC      0x28
+#define INT_SERIAL   0x24
+#define EXP_PF       0x0E
 
 /*
  * Setup IDT
@@ -22,8 +26,8 @@
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: Initializes the IDT with exceptions 1 ~
- *                 19 and keyboard interrupt (0x21) as well
- *                 as real time clock (0x28)
+ *                 19 and keyboard interrupt (0x21), COM1
+ *                 (0x24) as well as real time clock (0x28)
  */
 void setup_idt(){
     //idt[256] idt entries
@@ -85,8 +89,10 @@ void setup_idt(){
             if (i == 13) {
                 SET_IDT_ENTRY(idt[i], exception13);
             }
-            if (i == 14) {
-                SET_IDT_ENTRY(idt[i], exception14);
+            if (i == EXP_PF) {
+                // interrupt gate, so cr2 is read before anything else can fault
+                idt[i].reserved3 = 0;
+                SET_IDT_ENTRY(idt[i], page_fault_wrapper);
             }
             if (i == 16) {
                 SET_IDT_ENTRY(idt[i], exception16);
@@ -121,6 +127,9 @@ void setup_idt(){
             {
                 SET_IDT_ENTRY(idt[i], rtc_irq);
             }
+            if (i == INT_SERIAL) {
+                SET_IDT_ENTRY(idt[i], serial_irq);
+            }
         }
         //system call 0x80
         if (i == 0x80) {
@@ -145,126 +154,122 @@ void setup_idt(){
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: print the exception out on the console
+ *   SIDE EFFECTS: print the exception out on the console and log it
  */
 
 int exception0(){
     cli();
-    printf("EXCEPTION: Divide Error\n");
-    while(1);
-    sti();
+    klog_print("EXCEPTION: Divide Error\n");
+    halt_cpu();
 }
 int exception1(){
     cli();
-    printf("EXCEPTION: RESERVED\n");
-    while(1);
-    sti();
+    klog_print("EXCEPTION: RESERVED\n");
+    halt_cpu();
 }
 int exception2(){
     cli();
-    printf("EXCEPTION: NMI Interrupt\n");
-    while(1);
-    sti();
+    klog_print("EXCEPTION: NMI Interrupt\n");
+    halt_cpu();
 }
 int exception3(){
     cli();
-    printf("EXCEPTION: Breakpoint\n");
-    while(1);
-    sti();
+    klog_print("EXCEPTION: Breakpoint\n");
+    halt_cpu();
 }
 int exception4(){
     cli();
-    printf("EXCEPTION: Overflow\n");
-    while(1);
-    sti();
+    klog_print("EXCEPTION: Overflow\n");
+    halt_cpu();
 }
 int exception5(){
     cli();
-    printf("EXCEPTION: BOUND Range Exceeded\n");
-    while(1);
-    sti();
+    klog_print("EXCEPTION: BOUND Range Exceeded\n");
+    halt_cpu();
 }
 int exception6(){
     cli();
-    printf("EXCEPTION: Invalid Opcode\n");
-    while(1);
-    sti();
+    klog_print("EXCEPTION: Invalid Opcode\n");
+    halt_cpu();
 }
 int exception7(){
     cli();
-    printf("EXCEPTION: Device Not Available\n");
-    while(1);
-    sti();
+    klog_print("EXCEPTION: Device Not Available\n");
+    halt_cpu();
 }
 int exception8(){
     cli();
-    printf("EXCEPTION: Double Fault\n");
-    while(1);
-    sti();
+    klog_print("EXCEPTION: Double Fault\n");
+    halt_cpu();
 }
 int exception9(){
     cli();
-    printf("EXCEPTION: Coprocessor Segment Overrun\n");
-    while(1);
-    sti();
+    klog_print("EXCEPTION: Coprocessor Segment Overrun\n");
+    halt_cpu();
 }
 int exception10(){
     cli();
-    printf("EXCEPTION: Invalid TSS\n");
-    while(1);
-    sti();
+    klog_print("EXCEPTION: Invalid TSS\n");
+    halt_cpu();
 }
 int exception11(){
     cli();
-    printf("EXCEPTION: Segment Not Present\n");
-    while(1);
-    sti();
+    klog_print("EXCEPTION: Segment Not Present\n");
+    halt_cpu();
 }
 int exception12(){
     cli();
-    printf("EXCEPTION: Stack-Segment Fault\n");
-    while(1);
-    sti();
+    klog_print("EXCEPTION: Stack-Segment Fault\n");
+    halt_cpu();
 }
 int exception13(){
     cli();
-    printf("EXCEPTION: General Protection\n");
-    while(1);
-    sti();
+    klog_print("EXCEPTION: General Protection\n");
+    halt_cpu();
 }
-int exception14(){
-    cli();
-    int fault;
+/*
+ * exception14
+ *   DESCRIPTION: page fault handler, faults on user pages that were not
+ *                loaded yet are resolved by the demand pager and return,
+ *                anything else is printed out and logged. A fault caused by
+ *                the running process ends it, only kernel faults stop the CPU
+ *   INPUTS: error--error code pushed by the processor
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 when the fault was resolved
+ *   SIDE EFFECTS: maps and fills the faulting user page, or halts the
+ *                 process
+ */
+int exception14(uint32_t error){
+    uint32_t fault;
     asm volatile("movl %%cr2, %0" \
-                 :  \
-                 :"r"(fault)    \
+                 :"=r"(fault)  \
+                 :             \
                  :"memory");
     
-    printf("EXCEPTION: Page Fault at 0x%x", fault);
-    while(1);
-    sti();
+    if (load_user_page(fault) == 0) {
+        return 0;
+    }
+    klog_print("EXCEPTION: Page Fault at 0x%x\n", fault);
+    user_fault(fault, error);
+    halt_cpu();
 }
 int exception16(){
     cli();
-    printf("EXCEPTION: x87 FPU Floating-Point Error\n");
-    while(1);
-    sti();
+    klog_print("EXCEPTION: x87 FPU Floating-Point Error\n");
+    halt_cpu();
 }
 int exception17(){
     cli();
-    printf("EXCEPTION: Alignment Check\n");
-    while(1);
-    sti();
+    klog_print("EXCEPTION: Alignment Check\n");
+    halt_cpu();
 }
 int exception18(){
     cli();
-    printf("EXCEPTION: Machine Check");
-    while(1);
-    sti();
+    klog_print("EXCEPTION: Machine Check\n");
+    halt_cpu();
 }
 int exception19(){
     cli();
-    printf("EXCEPTION: SIMD Floating-Point Exception\n");
-    while(1);
-    sti();
+    klog_print("EXCEPTION: SIMD Floating-Point Exception\n");
+    halt_cpu();
 }
@@ -25,7 +25,7 @@ int exception10();
 int exception11();
 int exception12();
 int exception13();
-int exception14();
+int exception14(uint32_t error);
 int exception16();
 int exception17();
 int exception18();
@@ -0,0 +1,241 @@
+/* image_cache.c - cache of program text pages shared by every process
+ * running the same executable
+ */
+
+#include "image_cache.h"
+#include "filesystem.h"
+#include "buddy.h"
+#include "slab.h"
+#include "lib.h"
+
+// Magic Numbers
+#define CACHE_ENTRIES       8
+#define IMAGE_MAX_PAGES     64                  // 256 kB of text per program
+#define PHOFF_OFFSET        28                  // ELF header fields
+#define PHENTSIZE_OFFSET    42
+#define PHNUM_OFFSET        44
+#define PHDR_SIZE           32
+#define PT_LOAD             1
+#define PF_W                2
+#define IMAGE_BASE          0x08048000
+
+// program header fields we care about
+typedef struct phdr_t {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t vaddr;
+    uint32_t paddr;
+    uint32_t filesz;
+    uint32_t memsz;
+    uint32_t flags;
+    uint32_t align;
+} phdr_t;
+
+// one cached program image, kmalloc'd while its slot is in use
+typedef struct image_t {
+    uint32_t inode;
+    uint32_t refcount;
+    uint32_t npages;
+    uint8_t shared[IMAGE_MAX_PAGES];
+    uint32_t frame[IMAGE_MAX_PAGES];
+} image_t;
+
+static image_t* images[CACHE_ENTRIES];
+
+// Local functions
+static void image_scan(image_t* img);
+static void image_evict(int32_t slot);
+
+/*
+ * image_cache_init
+ *   DESCRIPTION: Empties the cache
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void image_cache_init(void) {
+    memset(images, 0, sizeof(images));
+}
+
+/*
+ * image_cache_get
+ *   DESCRIPTION: Finds the cache entry of an executable, creating it if
+ *                needed. Unreferenced entries stay cached so the next
+ *                launch of the program finds its text already loaded,
+ *                they are only evicted when a slot is needed
+ *   INPUTS: inode--inode of the executable
+ *   OUTPUTS: none
+ *   RETURN VALUE: slot of the entry, -1 if every slot is in use or
+ *                 memory ran out
+ *   SIDE EFFECTS: takes a reference on the entry
+ */
+int32_t image_cache_get(uint32_t inode) {
+    int32_t i;
+    int32_t free_slot = -1;
+    int32_t victim = -1;
+
+    for(i = 0; i < CACHE_ENTRIES; i++) {
+        if(images[i] != NULL && images[i]->inode == inode) {
+            images[i]->refcount++;
+            return i;
+        }
+        if(images[i] == NULL && free_slot == -1) free_slot = i;
+        if(images[i] != NULL && images[i]->refcount == 0 && victim == -1) victim = i;
+    }
+
+    if(free_slot == -1) {
+        if(victim == -1) return -1;
+        image_evict(victim);
+        free_slot = victim;
+    }
+
+    images[free_slot] = kmalloc(sizeof(image_t));
+    if(images[free_slot] == NULL) return -1;
+    images[free_slot]->inode = inode;
+    images[free_slot]->refcount = 1;
+    image_scan(images[free_slot]);
+    return free_slot;
+}
+
+/*
+ * image_cache_put
+ *   DESCRIPTION: Drops a reference on a cache entry, the loaded pages
+ *                are kept
+ *   INPUTS: slot--entry returned by image_cache_get, ignored if -1
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void image_cache_put(int32_t slot) {
+    if(slot < 0 || slot >= CACHE_ENTRIES || images[slot] == NULL) return;
+    if(images[slot]->refcount > 0) images[slot]->refcount--;
+}
+
+/*
+ * image_page_shared
+ *   DESCRIPTION: Checks whether a page of the image only holds read only
+ *                segments, such pages are mapped read only into every
+ *                process running the program
+ *   INPUTS: slot--cache entry
+ *           page--page number counted from the start of the image
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the page is shared, 0 if it must be private
+ *   SIDE EFFECTS: none
+ */
+int32_t image_page_shared(int32_t slot, uint32_t page) {
+    if(slot < 0 || slot >= CACHE_ENTRIES || images[slot] == NULL) return 0;
+    if(page >= images[slot]->npages) return 0;
+    return images[slot]->shared[page];
+}
+
+/*
+ * image_page_frame
+ *   DESCRIPTION: Gets the physical frame holding a shared page
+ *   INPUTS: slot--cache entry
+ *           page--page number counted from the start of the image
+ *   OUTPUTS: none
+ *   RETURN VALUE: the frame, 0 if the page was not loaded yet
+ *   SIDE EFFECTS: none
+ */
+uint32_t image_page_frame(int32_t slot, uint32_t page) {
+    if(!image_page_shared(slot, page)) return 0;
+    return images[slot]->frame[page];
+}
+
+/*
+ * image_page_alloc
+ *   DESCRIPTION: Reserves a frame for a shared page. When memory runs
+ *                out the pages of an unreferenced program are dropped
+ *   INPUTS: slot--cache entry
+ *           page--page number counted from the start of the image
+ *   OUTPUTS: none
+ *   RETURN VALUE: the frame, 0 if none is available (the caller then
+ *                 falls back to a private page)
+ *   SIDE EFFECTS: the caller must fill the frame before anything else runs
+ */
+uint32_t image_page_alloc(int32_t slot, uint32_t page) {
+    int32_t i;
+    uint32_t frame;
+
+    if(!image_page_shared(slot, page)) return 0;
+
+    frame = frame_alloc(0);
+    for(i = 0; frame == 0 && i < CACHE_ENTRIES; i++) {
+        if(i != slot && images[i] != NULL && images[i]->refcount == 0) {
+            image_evict(i);
+            frame = frame_alloc(0);
+        }
+    }
+    images[slot]->frame[page] = frame;
+    return frame;
+}
+
+/*
+ * image_scan
+ *   DESCRIPTION: Reads the ELF program headers of an image and works out
+ *                which of its pages can be shared. Images are loaded as a
+ *                flat copy of the file, so a page is shared unless it
+ *                overlaps the address range of a writable segment
+ *   INPUTS: img--entry to fill in
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: if the headers cannot be read nothing is shared
+ */
+static void image_scan(image_t* img) {
+    dentry_t dentry;
+    phdr_t phdr;
+    uint32_t phoff = 0;
+    uint16_t phentsize = 0;
+    uint16_t phnum = 0;
+    uint32_t i, first, last, length;
+
+    dentry.inode = img->inode;
+    length = inode_find(dentry)->length;
+    memset(img->shared, 0, sizeof(img->shared));
+    memset(img->frame, 0, sizeof(img->frame));
+    img->npages = (length + FRAME_SIZE - 1) / FRAME_SIZE;
+    if(img->npages > IMAGE_MAX_PAGES) img->npages = IMAGE_MAX_PAGES;
+
+    if(read_data(img->inode, PHOFF_OFFSET, (uint8_t*)&phoff, sizeof(phoff)) != sizeof(phoff) ||
+       read_data(img->inode, PHENTSIZE_OFFSET, (uint8_t*)&phentsize, sizeof(phentsize)) != sizeof(phentsize) ||
+       read_data(img->inode, PHNUM_OFFSET, (uint8_t*)&phnum, sizeof(phnum)) != sizeof(phnum) ||
+       phentsize < PHDR_SIZE) {
+        img->npages = 0;
+        return;
+    }
+
+    for(i = 0; i < img->npages; i++) img->shared[i] = 1;
+
+    for(i = 0; i < phnum; i++) {
+        if(read_data(img->inode, phoff + i*phentsize, (uint8_t*)&phdr, PHDR_SIZE) != PHDR_SIZE) {
+            img->npages = 0;
+            return;
+        }
+        if(phdr.type != PT_LOAD || !(phdr.flags & PF_W) || phdr.memsz == 0) continue;
+        if(phdr.vaddr + phdr.memsz <= IMAGE_BASE) continue;
+        first = (phdr.vaddr < IMAGE_BASE) ? 0 : (phdr.vaddr - IMAGE_BASE) / FRAME_SIZE;
+        last = (phdr.vaddr + phdr.memsz - 1 - IMAGE_BASE) / FRAME_SIZE;
+        for(; first <= last && first < img->npages; first++) img->shared[first] = 0;
+    }
+}
+
+/*
+ * image_evict
+ *   DESCRIPTION: Releases the frames of an unreferenced entry and frees
+ *                the entry and its slot
+ *   INPUTS: slot--entry to evict
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void image_evict(int32_t slot) {
+    image_t* img = images[slot];
+    uint32_t i;
+
+    for(i = 0; i < IMAGE_MAX_PAGES; i++) {
+        if(img->frame[i] != 0) frame_free(img->frame[i], 0);
+    }
+    kfree(img);
+    images[slot] = NULL;
+}
@@ -0,0 +1,23 @@
+/* image_cache.h - cache of program text pages shared by every process
+ * running the same executable
+ */
+
+#ifndef _IMAGE_CACHE_H
+#define _IMAGE_CACHE_H
+
+#include "types.h"
+
+/* Initialize the image cache */
+void image_cache_init(void);
+/* Find or create the cache entry of an executable and take a reference */
+int32_t image_cache_get(uint32_t inode);
+/* Drop a reference taken by image_cache_get */
+void image_cache_put(int32_t slot);
+/* Check whether a page of the image is read only and can be shared */
+int32_t image_page_shared(int32_t slot, uint32_t page);
+/* Physical frame of a shared page, 0 if it has not been loaded yet */
+uint32_t image_page_frame(int32_t slot, uint32_t page);
+/* Reserve the physical frame a shared page is loaded into */
+uint32_t image_page_alloc(int32_t slot, uint32_t page);
+
+#endif
@@ -15,6 +15,14 @@
 #include "terminal.h"
 #include "syscall.h"
 #include "pit.h"
+#include "serial.h"
+#include "klog.h"
+#include "clock.h"
+#include "timer.h"
+#include "buddy.h"
+#include "slab.h"
+#include "scheduler.h"
+#include "handler_wrappers.h"
 
 /* Macros. */
 /* Check if the bit BIT in FLAGS is set. */
@@ -23,6 +31,7 @@
 #define OUTPUT_FILE_SIZE 1000
 #define TEN_DECIMAL 10
 #define TWELVE 12
+#define CPUID_SEP (1 << 11)
 
 /* Check if MAGIC is valid and print the Multiboot information structure
    pointed by ADDR. */
@@ -37,7 +46,7 @@ entry (unsigned long magic, unsigned long addr)
 	/* Am I booted by a Multiboot-compliant boot loader? */
 	if (magic != MULTIBOOT_BOOTLOADER_MAGIC)
 	{
-		printf ("Invalid magic number: 0x%#x\n", (unsigned) magic);
+		klog_print ("Invalid magic number: 0x%#x\n", (unsigned) magic);
 		return;
 	}
 
@@ -45,20 +54,20 @@ entry (unsigned long magic, unsigned long addr)
 	mbi = (multiboot_info_t *) addr;
 
 	/* Print out the flags. */
-	printf ("flags = 0x%#x\n", (unsigned) mbi->flags);
+	klog ("flags = 0x%#x\n", (unsigned) mbi->flags);
 
 	/* Are mem_* valid? */
 	if (CHECK_FLAG (mbi->flags, 0))
-		printf ("mem_lower = %uKB, mem_upper = %uKB\n",
+		klog ("mem_lower = %uKB, mem_upper = %uKB\n",
 				(unsigned) mbi->mem_lower, (unsigned) mbi->mem_upper);
 
 	/* Is boot_device valid? */
 	if (CHECK_FLAG (mbi->flags, 1))
-		printf ("boot_device = 0x%#x\n", (unsigned) mbi->boot_device);
+		klog ("boot_device = 0x%#x\n", (unsigned) mbi->boot_device);
 
 	/* Is the command line passed? */
 	if (CHECK_FLAG (mbi->flags, 2))
-		printf ("cmdline = %s\n", (char *) mbi->cmdline);
+		klog ("cmdline = %s\n", (char *) mbi->cmdline);
 
 	uint32_t fs_addr;
 	if (CHECK_FLAG (mbi->flags, 3)) {
@@ -66,14 +75,14 @@ entry (unsigned long magic, unsigned long addr)
 		int i;
 		module_t* mod = (module_t*)mbi->mods_addr;
 		while(mod_count < mbi->mods_count) {
-			printf("Module %d loaded at address: 0x%#x\n", mod_count, (unsigned int)mod->mod_start);
+			klog("Module %d loaded at address: 0x%#x\n", mod_count, (unsigned int)mod->mod_start);
 			fs_addr = mod->mod_start;
-			printf("Module %d ends at address: 0x%#x\n", mod_count, (unsigned int)mod->mod_end);
-			printf("First few bytes of module:\n");
+			klog("Module %d ends at address: 0x%#x\n", mod_count, (unsigned int)mod->mod_end);
+			klog("First few bytes of module:\n");
 			for(i = 0; i<16; i++) {
-				printf("0x%x ", *((char*)(mod->mod_start+i)));
+				klog("0x%x ", *((char*)(mod->mod_start+i)));
 			}
-			printf("\n");
+			klog("\n");
 			mod_count++;
 			mod++;
 		}
@@ -81,7 +90,7 @@ entry (unsigned long magic, unsigned long addr)
 	/* Bits 4 and 5 are mutually exclusive! */
 	if (CHECK_FLAG (mbi->flags, 4) && CHECK_FLAG (mbi->flags, 5))
 	{
-		printf ("Both bits 4 and 5 are set.\n");
+		klog ("Both bits 4 and 5 are set.\n");
 		return;
 	}
 
@@ -90,7 +99,7 @@ entry (unsigned long magic, unsigned long addr)
 	{
 		elf_section_header_table_t *elf_sec = &(mbi->elf_sec);
 
-		printf ("elf_sec: num = %u, size = 0x%#x,"
+		klog ("elf_sec: num = %u, size = 0x%#x,"
 				" addr = 0x%#x, shndx = 0x%#x\n",
 				(unsigned) elf_sec->num, (unsigned) elf_sec->size,
 				(unsigned) elf_sec->addr, (unsigned) elf_sec->shndx);
@@ -101,13 +110,13 @@ entry (unsigned long magic, unsigned long addr)
 	{
 		memory_map_t *mmap;
 
-		printf ("mmap_addr = 0x%#x, mmap_length = 0x%x\n",
+		klog ("mmap_addr = 0x%#x, mmap_length = 0x%x\n",
 				(unsigned) mbi->mmap_addr, (unsigned) mbi->mmap_length);
 		for (mmap = (memory_map_t *) mbi->mmap_addr;
 				(unsigned long) mmap < mbi->mmap_addr + mbi->mmap_length;
 				mmap = (memory_map_t *) ((unsigned long) mmap
 					+ mmap->size + sizeof (mmap->size)))
-			printf (" size = 0x%x,     base_addr = 0x%#x%#x\n"
+			klog (" size = 0x%x,     base_addr = 0x%#x%#x\n"
 					"     type = 0x%x,  length    = 0x%#x%#x\n",
 					(unsigned) mmap->size,
 					(unsigned) mmap->base_addr_high,
@@ -158,6 +167,21 @@ entry (unsigned long magic, unsigned long addr)
 		ltr(KERNEL_TSS);
 	}
 
+	/* Fast system calls: SYSENTER takes the kernel CS from the MSR and SS
+	 * from the next GDT entry, SYSEXIT the user CS and SS from the two after
+	 * that, which is the order of our GDT */
+	{
+		uint32_t eax = 1, ebx, ecx, edx;
+		asm volatile("cpuid"
+				: "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+		if (edx & CPUID_SEP) {
+			wrmsr(MSR_SYSENTER_CS, KERNEL_CS);
+			wrmsr(MSR_SYSENTER_ESP, (uint32_t)sysenter_stack);
+			wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+			sysenter_enabled = 1;
+		}
+	}
+
 	/* Initialize devices, memory, filesystem, enable device interrupts on the
 	 * PIC, any other initialization stuff... */
 	
@@ -174,11 +198,18 @@ entry (unsigned long magic, unsigned long addr)
 	/* Hardware Initialization*/
 	rtc_init();				// Initialize RTC
 	keyboard_init(); 		// Initialize Keyboard
+	serial_init();			// Initialize COM1, boot output so far goes out now
 
 
+	/* Frame allocator, reads the memory map so it runs before paging */
+	buddy_init(mbi);
+
 	/*Paging Initialization*/
 	paging_init();
 
+	/* Kernel heap, lives in the kernel page */
+	slab_init();
+
     load_filesystem((boot_block_t*)filesystem_loaded);
     //load_filesystem((boot_block_t*)((module_t*)mbi -> mods_addr) -> mod_start);
     
@@ -190,7 +221,7 @@ entry (unsigned long magic, unsigned long addr)
 	/* Do not enable the following until after you have set up your
 	 * IDT correctly otherwise QEMU will triple fault and simple close
 	 * without showing you any output */
-	printf("Enabling Interrupts\n");
+	klog("Enabling Interrupts\n");
 	sti();
 
     terminal_init();
@@ -296,9 +327,13 @@ entry (unsigned long magic, unsigned long addr)
 	/* Execute the first program (`shell') ... */
 	//execute((uint8_t*)"shell");
 	syscall_init();
-	pit_init(100);
-
-	/* Spin (nicely, so we don't chew up cycles) */
-	asm volatile(".1: hlt; jmp .1;");
+	sched_init();
+	clock_init();			// Measure the TSC against PIT channel 2
+	clock_set_features(sysenter_enabled ? TIME_FEAT_SYSENTER : 0);
+	timer_init(jiffies);
+	pit_init(PIT_HZ);
+
+	/* Become the idle task (halts, so we don't chew up cycles) */
+	cpu_idle();
 }
 
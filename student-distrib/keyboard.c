@@ -19,6 +19,8 @@ uint8_t status_backspace;
 uint8_t status_altf1;
 uint8_t status_altf2;
 uint8_t status_altf3;
+uint8_t status_pgup;
+uint8_t status_pgdn;
 
 // Magic Numbers
 #define KBD_CMD_PORT		0x64
@@ -114,6 +116,8 @@ keyboard_init() {
     status_enter = 0;
     status_clear = 0;
     status_backspace = 0;
+    status_pgup = 0;
+    status_pgdn = 0;
 
 	//enable the keyboard, set the corresponding interrupt line 1
 	enable_irq(1);
@@ -176,6 +180,14 @@ void keyboard_handler() {
 		
         status_backspace = 0;
     }
+    else if(status_pgup == 1) {
+        terminal_scrollback(SB_PAGE);
+        status_pgup = 0;
+    }
+    else if(status_pgdn == 1) {
+        terminal_scrollback(-SB_PAGE);
+        status_pgdn = 0;
+    }
     else if(status_altf1 == 1){
     	terminal_switch(0);
     	status_altf1 = 0;
@@ -240,6 +252,8 @@ keyboard_get_char() {
 	// else if (status_alt==1 && scan_code == ONE) status_altf1 = 1;
 	// else if (status_alt==1 && scan_code == TWO) status_altf2 = 1;
 	// else if (status_alt==1 && scan_code == THREE) status_altf3 = 1;
+	else if (status_shift==1 && scan_code == PGUP_pressed) status_pgup = 1;
+	else if (status_shift==1 && scan_code == PGDN_pressed) status_pgdn = 1;
     else if (scan_code == ENTER) status_enter = 1;
     else if (scan_code == BACKSPACE) status_backspace = 1;
 	else if (scan_code == CAPSLOCK) {
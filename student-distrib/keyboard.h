@@ -44,6 +44,8 @@
 #define F12			0
 #define L_pressed	0x26
 #define ESC_pressed 0x01
+#define PGUP_pressed 0x49
+#define PGDN_pressed 0x51
 
 #define ONE			0x02
 #define TWO			0x03
@@ -0,0 +1,210 @@
+/* klog.c - kernel log ring. Appending takes no lock: a writer reserves its
+ * bytes with xadd and copies them in, so an interrupt handler can log while
+ * the code it interrupted is logging too
+ */
+
+#include "klog.h"
+#include "slab.h"
+#include "lib.h"
+#include "serial.h"
+#include "syscall.h"
+#include "terminal.h"
+
+/* The ring, position p of the log is at klog_buf[p & (KLOG_SIZE - 1)] */
+static int8_t klog_buf[KLOG_SIZE];
+/* End of the space handed out to writers */
+static volatile uint32_t klog_head;
+/* End of the text readers may see, everything before it is written */
+static volatile uint32_t klog_done;
+/* Writers between reserving and finishing their copy */
+static volatile uint32_t klog_writers;
+
+/* Atomically add to a counter and return its old value */
+static uint32_t xadd(volatile uint32_t* p, uint32_t v);
+/* Atomically replace a counter if it still holds old, returns what it held */
+static uint32_t cmpxchg(volatile uint32_t* p, uint32_t old, uint32_t new);
+
+/*
+ * klog_write
+ *   DESCRIPTION: Appends bytes to the log. Writers nest, an interrupt
+ *                handler finishes before the writer it interrupted goes
+ *                on, so the last one out knows everything reserved so far
+ *                has been written and publishes it to readers
+ *   INPUTS: s--bytes to append
+ *           n--number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: overwrites the oldest part of the log once it is full
+ */
+void klog_write(const int8_t* s, uint32_t n) {
+    uint32_t start, end, old, i;
+
+    if(n > KLOG_SIZE) {
+        s += n - KLOG_SIZE;
+        n = KLOG_SIZE;
+    }
+
+    xadd(&klog_writers, 1);
+    start = xadd(&klog_head, n);
+    for(i = 0; i < n; i++) {
+        klog_buf[(start + i) & (KLOG_SIZE - 1)] = s[i];
+    }
+
+    if(xadd(&klog_writers, -1) == 1) {
+        // a writer that got in after the decrement published its own end,
+        // never move klog_done backwards past it
+        end = klog_head;
+        do {
+            old = klog_done;
+            if((int32_t)(end - old) <= 0) break;
+        } while(cmpxchg(&klog_done, old, end) != old);
+    }
+}
+
+/*
+ * klog
+ *   DESCRIPTION: Formats a message like printf and appends it to the log,
+ *                it is copied to COM1 but not drawn on the screen
+ *   INPUTS: format--printf format string, followed by its arguments
+ *   OUTPUTS: none
+ *   RETURN VALUE: length of the message
+ *   SIDE EFFECTS: none
+ */
+int32_t klog(int8_t* format, ...) {
+    int8_t line[KLOG_LINE];
+    int32_t i, n;
+
+    n = vsnprintf(line, KLOG_LINE, format, (int32_t*)&format + 1);
+    klog_write(line, n);
+    for(i = 0; i < n; i++) serial_putc(line[i]);
+
+    return n;
+}
+
+/*
+ * klog_print
+ *   DESCRIPTION: Formats a message like printf, appends it to the log and
+ *                prints it, for errors that must be seen right away
+ *   INPUTS: format--printf format string, followed by its arguments
+ *   OUTPUTS: none
+ *   RETURN VALUE: length of the message
+ *   SIDE EFFECTS: writes to the screen
+ */
+int32_t klog_print(int8_t* format, ...) {
+    int8_t line[KLOG_LINE];
+    int32_t n;
+
+    n = vsnprintf(line, KLOG_LINE, format, (int32_t*)&format + 1);
+    klog_write(line, n);
+    puts(line);
+
+    return n;
+}
+
+/*
+ * dmesg_open
+ *   DESCRIPTION: Opens the log, reading starts at the oldest text kept.
+ *                A fresh table of the slab caches is logged first so
+ *                dmesg shows the allocator as it is now
+ *   INPUTS: filename--not used
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: none
+ */
+int32_t dmesg_open(const uint8_t* filename) {
+    kmem_dump();
+    return 0;
+}
+
+/*
+ * dmesg_close
+ *   DESCRIPTION: Closes the log--does nothing
+ *   INPUTS: fd--not used
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: none
+ */
+int32_t dmesg_close(int32_t fd) {
+    return 0;
+}
+
+/*
+ * dmesg_read
+ *   DESCRIPTION: Copies the log from the position of the descriptor up to
+ *                the published end, text overwritten since is skipped.
+ *                Interrupts are off so no writer runs during the copy
+ *   INPUTS: fd--descriptor of the log, keeps the position in fpos
+ *           buf--buffer to fill
+ *           nbytes--size of buf
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes read, 0 at the end of the log
+ *   SIDE EFFECTS: advances the position of the descriptor
+ */
+int32_t dmesg_read(int32_t fd, void* buf, int32_t nbytes) {
+    pcb_t* curr_pcb = get_pcb(terminal[processing_terminal].cur_pid);
+    uint32_t flags, pos, end;
+    int32_t i;
+
+    if(buf == NULL || nbytes <= 0) return 0;
+
+    cli_and_save(flags);
+    pos = curr_pcb->f_array[fd].fpos;
+    end = klog_done;
+    if(end - pos > KLOG_SIZE) pos = end - KLOG_SIZE;
+    for(i = 0; i < nbytes && pos != end; i++, pos++) {
+        ((int8_t*)buf)[i] = klog_buf[pos & (KLOG_SIZE - 1)];
+    }
+    curr_pcb->f_array[fd].fpos = pos;
+    restore_flags(flags);
+
+    return i;
+}
+
+/*
+ * dmesg_write
+ *   DESCRIPTION: The log cannot be written from user space
+ *   INPUTS: fd, buf, nbytes--not used
+ *   OUTPUTS: none
+ *   RETURN VALUE: -1
+ *   SIDE EFFECTS: none
+ */
+int32_t dmesg_write(int32_t fd, const void* buf, int32_t nbytes) {
+    return -1;
+}
+
+/*
+ * xadd
+ *   DESCRIPTION: Atomically adds to a counter
+ *   INPUTS: p--counter
+ *           v--amount to add
+ *   OUTPUTS: none
+ *   RETURN VALUE: value of the counter before the add
+ *   SIDE EFFECTS: none
+ */
+static uint32_t xadd(volatile uint32_t* p, uint32_t v) {
+    asm volatile("lock; xaddl %0, %1"
+                 : "+r"(v), "+m"(*p)
+                 :
+                 : "memory", "cc");
+    return v;
+}
+
+/*
+ * cmpxchg
+ *   DESCRIPTION: Atomically stores new into a counter that still holds old
+ *   INPUTS: p--counter
+ *           old--value expected
+ *           new--value to store
+ *   OUTPUTS: none
+ *   RETURN VALUE: value the counter held, the store happened if it is old
+ *   SIDE EFFECTS: none
+ */
+static uint32_t cmpxchg(volatile uint32_t* p, uint32_t old, uint32_t new) {
+    uint32_t prev;
+
+    asm volatile("lock; cmpxchgl %2, %1"
+                 : "=a"(prev), "+m"(*p)
+                 : "r"(new), "0"(old)
+                 : "memory", "cc");
+    return prev;
+}
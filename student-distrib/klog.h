@@ -0,0 +1,29 @@
+/* klog.h - kernel log ring, read back through the dmesg pseudo-file
+ */
+
+#ifndef _KLOG_H
+#define _KLOG_H
+
+#include "types.h"
+
+#define KLOG_NAME               "dmesg"     // name open() takes for the log
+#define KLOG_SIZE               0x4000      // ring size, a power of two
+#define KLOG_LINE               256         // longest formatted message
+
+/* Append raw bytes to the log, safe from any context */
+void klog_write(const int8_t* s, uint32_t n);
+/* printf into the log, a copy goes to COM1 */
+int32_t klog(int8_t* format, ...);
+/* printf into the log and onto the screen */
+int32_t klog_print(int8_t* format, ...);
+
+/* Open the log */
+int32_t dmesg_open(const uint8_t* filename);
+/* Close the log */
+int32_t dmesg_close(int32_t fd);
+/* Read the log from where this descriptor left off */
+int32_t dmesg_read(int32_t fd, void* buf, int32_t nbytes);
+/* The log is read only */
+int32_t dmesg_write(int32_t fd, const void* buf, int32_t nbytes);
+
+#endif
@@ -3,6 +3,7 @@
  */
 
 #include "lib.h"
+#include "serial.h"
 #define VIDEO 0xB8000
 #define NUM_COLS 80
 #define NUM_ROWS 25
@@ -29,6 +30,51 @@ clear(void)
     }
 }
 
+/*
+* void set_video_mem(char* mem);
+*   Inputs: mem - first character of the screen
+*   Return Value: none
+*	Function: Follows the CRTC start address when the terminal scrolls
+*/
+
+void
+set_video_mem(char* mem)
+{
+    video_mem = mem;
+}
+
+/* Receives each character printf produces */
+typedef void (*out_t)(uint8_t c, void* arg);
+
+/* Where vsnprintf puts its text */
+typedef struct buf_sink_t {
+	int8_t* dst;
+	uint32_t len;
+	uint32_t size;
+} buf_sink_t;
+
+static int32_t format_out(out_t out, void* arg, int8_t* format, int32_t* esp);
+
+/* Sinks of format_out: the console, a string, and a buffer */
+static void
+putc_out(uint8_t c, void* arg)
+{
+	putc(c);
+}
+
+static void
+out_str(out_t out, void* arg, int8_t* s)
+{
+	while(*s != '\0') out((uint8_t)*s++, arg);
+}
+
+static void
+buf_out(uint8_t c, void* arg)
+{
+	buf_sink_t* sink = arg;
+	if(sink->len < sink->size) sink->dst[sink->len++] = c;
+}
+
 /* Standard printf().
  * Only supports the following format strings:
  * %%  - print a literal '%' character
@@ -50,13 +96,53 @@ clear(void)
 int32_t
 printf(int8_t *format, ...)
 {
-	/* Pointer to the format string */
-	int8_t* buf = format;
-
 	/* Stack pointer for the other parameters */
 	int32_t* esp = (void *)&format;
 	esp++;
 
+	return format_out(putc_out, NULL, format, esp);
+}
+
+/*
+* int32_t vsnprintf(int8_t* dst, uint32_t size, int8_t* format, int32_t* args);
+*   Inputs: dst - buffer for the text
+*           size - size of dst, the text is cut to fit with its '\0'
+*           format - printf format string
+*           args - first argument after the format string on the stack
+*   Return Value: number of characters stored, not counting the '\0'
+*	Function: printf into a buffer, for callers that take their own ...
+*/
+
+int32_t
+vsnprintf(int8_t* dst, uint32_t size, int8_t* format, int32_t* args)
+{
+	buf_sink_t sink;
+
+	if(size == 0) return 0;
+	sink.dst = dst;
+	sink.len = 0;
+	sink.size = size - 1;
+	format_out(buf_out, &sink, format, args);
+	dst[sink.len] = '\0';
+
+	return sink.len;
+}
+
+/*
+* static int32_t format_out(out_t out, void* arg, int8_t* format, int32_t* esp);
+*   Inputs: out - called with every character produced and arg
+*           format - printf format string
+*           esp - first argument after the format string on the stack
+*   Return Value: length of the format string
+*	Function: The formatting engine behind printf and vsnprintf
+*/
+
+static int32_t
+format_out(out_t out, void* arg, int8_t* format, int32_t* esp)
+{
+	/* Pointer to the format string */
+	int8_t* buf = format;
+
 	while(*buf != '\0') {
 		switch(*buf) {
 			case '%':
@@ -69,7 +155,7 @@ format_char_switch:
 					switch(*buf) {
 						/* Print a literal '%' character */
 						case '%':
-							putc('%');
+							out('%', arg);
 							break;
 
 						/* Use alternate formatting */
@@ -87,7 +173,7 @@ format_char_switch:
 								int8_t conv_buf[64];
 								if(alternate == 0) {
 									itoa(*((uint32_t *)esp), conv_buf, 16);
-									puts(conv_buf);
+									out_str(out, arg, conv_buf);
 								} else {
 									int32_t starting_index;
 									int32_t i;
@@ -97,7 +183,7 @@ format_char_switch:
 										conv_buf[i] = '0';
 										i++;
 									}
-									puts(&conv_buf[starting_index]);
+									out_str(out, arg, &conv_buf[starting_index]);
 								}
 								esp++;
 							}
@@ -108,7 +194,7 @@ format_char_switch:
 							{
 								int8_t conv_buf[36];
 								itoa(*((uint32_t *)esp), conv_buf, 10);
-								puts(conv_buf);
+								out_str(out, arg, conv_buf);
 								esp++;
 							}
 							break;
@@ -124,20 +210,20 @@ format_char_switch:
 								} else {
 									itoa(value, conv_buf, 10);
 								}
-								puts(conv_buf);
+								out_str(out, arg, conv_buf);
 								esp++;
 							}
 							break;
 
 						/* Print a single character */
 						case 'c':
-							putc( (uint8_t) *((int32_t *)esp) );
+							out( (uint8_t) *((int32_t *)esp), arg );
 							esp++;
 							break;
 
 						/* Print a NULL-terminated string */
 						case 's':
-							puts( *((int8_t **)esp) );
+							out_str(out, arg,  *((int8_t **)esp) );
 							esp++;
 							break;
 
@@ -149,7 +235,7 @@ format_char_switch:
 				break;
 
 			default:
-				putc(*buf);
+				out(*buf, arg);
 				break;
 		}
 		buf++;
@@ -181,12 +267,13 @@ puts(int8_t* s)
 * void putc(uint8_t c);
 *   Inputs: uint_8* c = character to print
 *   Return Value: void
-*	Function: Output a character to the console 
+*	Function: Output a character to the console and COM1
 */
 
 void
 putc(uint8_t c)
 {
+    serial_putc(c);
     if(c == '\n' || c == '\r') {
         screen_y++;
         screen_x=0;
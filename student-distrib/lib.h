@@ -8,12 +8,14 @@
 #include "types.h"
 
 int32_t printf(int8_t *format, ...);
+int32_t vsnprintf(int8_t* dst, uint32_t size, int8_t* format, int32_t* args);
 void putc(uint8_t c);
 int32_t puts(int8_t *s);
 int8_t *itoa(uint32_t value, int8_t* buf, int32_t radix);
 int8_t *strrev(int8_t* s);
 uint32_t strlen(const int8_t* s);
 void clear(void);
+void set_video_mem(char* mem);
 
 void* memset(void* s, int32_t c, uint32_t n);
 void* memset_word(void* s, int32_t c, uint32_t n);
@@ -131,6 +133,38 @@ do {                                    \
 			);                      \
 } while(0)
 
+/* Write a model specific register, the high 32 bits are cleared */
+#define wrmsr(msr, val)                 \
+do {                                    \
+	asm volatile("wrmsr"                \
+			:                       \
+			: "c"(msr), "a"(val), "d"(0) \
+			: "memory"              \
+			);                      \
+} while(0)
+
+/* Read the time stamp counter into two 32-bit halves */
+#define rdtsc(lo, hi)                   \
+do {                                    \
+	asm volatile("rdtsc"                \
+			: "=a"(lo), "=d"(hi)    \
+			);                      \
+} while(0)
+
+/* Stop this processor for good - interrupts off, halted. Used when
+ * the kernel cannot go on */
+#define halt_cpu()                      \
+do {                                    \
+	while(1) {                          \
+		asm volatile("cli           \n      \
+				hlt"                \
+				:                   \
+				:                   \
+				: "memory", "cc"    \
+				);                  \
+	}                                   \
+} while(0)
+
 /* Restore flags
  * Puts the value in "flags" into the EFLAGS register.  Most often used
  * after a cli_and_save_flags(flags) */
@@ -2,16 +2,39 @@
  */
 
 #include "paging.h"
+#include "buddy.h"
 #include "lib.h"
 
 // Magic Numbers
 #define VIDEO               0xB8000
 #define PAGE_4KB            0x1000
+#define VIDEO_PAGES         8           // 0xB8000-0xBFFFF
+#define TERM_VIDEO          0xBA000     // video memory of the terminals
+#define TERM_VIDEO_SIZE     0x2000
+#define NUM_TERMINAL        3
 #define NUM_ENTRIES         1024
 #define SIZE_4KB            4096 
 #define SHIFT_TO_10         22
 #define SHIFT_TO_20         12
 #define KERNEL_ADDRESS      0x400000
+#define DIRECT_PDE_START    2                   // 8 MB
+#define USER_PDE            32                  // 128 MB
+#define PAGE_4MB            0x400000
+#define PTE_PRESENT         0x1
+#define PTE_NOT_PRESENT     0x6                 // user, R/W, not present
+#define PTE_USER_RO         0x5                 // user, read only, present
+#define PTE_USER_RW         0x7                 // user, R/W, present
+#define PTE_SHARED          0x200               // available bit: frame owned by the image cache
+#define PG_GLOBAL           0x100               // kept in the TLB across CR3 loads
+#define PDE_PS              0x80
+#define CR4_PSE             0x00000010
+#define CR4_PGE             0x00000080
+#define CR0_PG_PE           0x80000001
+#define CR0_WP              0x00010000          // read only pages hold for the kernel too
+#define USER_VID            0xFFC00000
+#define ADDR_MASK           0xFFFFF000
+#define TBL_IDX_MASK        0x3FF
+#define TIME_PTE            (NUM_ENTRIES - 1)   // 0xFFFFF000, the last page of the vidmap table
 
 // global variables: Page Directory aligned to 4096 and Page Table aligned to 4096
 static uint32_t pg_drct[NUM_ENTRIES] __attribute__((aligned (SIZE_4KB)));
@@ -21,6 +44,10 @@ static uint32_t vid_pg_tbl_1[NUM_ENTRIES] __attribute__((aligned(SIZE_4KB)));
 // Local functions
 /* Helper function that writes to Control Registers to enable paging */
 void enable_paging(void);
+/* Helper function that gets the Page Directory loaded in CR3 */
+static uint32_t* cur_pg_drct(void);
+/* Helper function that flushes the non-global TLB entries */
+static void flush_tlb(void);
 
 /*
  * paging_init
@@ -57,20 +84,26 @@ void paging_init(void) {
     for(i = 0; i < NUM_ENTRIES; i++) {
         pg_tbl_1[i] = 0x2;                      // clear bit 0 (present), supervisor mode
     }
-    // map video memory
-    pg_tbl_1[VIDEO >> SHIFT_TO_20] = pg_tbl_1[VIDEO >> SHIFT_TO_20] | VIDEO | 0x3;
+    // map video memory, kernel pages are global so CR3 loads keep them
+    pg_tbl_1[VIDEO >> SHIFT_TO_20] = pg_tbl_1[VIDEO >> SHIFT_TO_20] | VIDEO | PG_GLOBAL | 0x3;
                                                 // set video memory address VIDEO
                                                 // set bit 0 (present)
                                                 // set bits 1 (R/W) and 2 (U/S)
-    // set video memory buffer for three terminal to present
-    pg_tbl_1[(VIDEO+1*PAGE_4KB) >> SHIFT_TO_20] = pg_tbl_1[(VIDEO+1*PAGE_4KB) >> SHIFT_TO_20] | (VIDEO+1*PAGE_4KB) | 0x3;
-    pg_tbl_1[(VIDEO+2*PAGE_4KB) >> SHIFT_TO_20] = pg_tbl_1[(VIDEO+2*PAGE_4KB) >> SHIFT_TO_20] | (VIDEO+2*PAGE_4KB) | 0x3;
-    pg_tbl_1[(VIDEO+3*PAGE_4KB) >> SHIFT_TO_20] = pg_tbl_1[(VIDEO+3*PAGE_4KB) >> SHIFT_TO_20] | (VIDEO+3*PAGE_4KB) | 0x3;
+    // the rest of the VGA text window holds the scroll ring and the
+    // buffers of the terminals in the background
+    for(i = 1; i < VIDEO_PAGES; i++) {
+        pg_tbl_1[(VIDEO+i*PAGE_4KB) >> SHIFT_TO_20] |= (VIDEO+i*PAGE_4KB) | PG_GLOBAL | 0x3;
+    }
     // 4-8 MB mapped to physical memory 4-8 MB (a single page)
-    pg_drct[1] = KERNEL_ADDRESS | 0x83;
+    pg_drct[1] = KERNEL_ADDRESS | PG_GLOBAL | 0x83;
                                                 // set kernel address 0x400000
-                                                // set bit 7 (PS) and bit 0 (present)
+                                                // set bit 8 (G), bit 7 (PS) and bit 0 (present)
                                                 // set bit 1 (R/W) and clear bit 2 (U/S)
+    // 8-128 MB mapped one to one for the kernel, the frame allocator hands out
+    // frames from there and the kernel reaches them at their physical address
+    for(i = DIRECT_PDE_START; i < USER_PDE; i++) {
+        pg_drct[i] = (i * PAGE_4MB) | PG_GLOBAL | 0x83;
+    }
     set_video();
     // enable paging
     enable_paging();
@@ -90,56 +123,43 @@ void enable_paging(void) {
 
    uint32_t cr4;
    asm volatile("mov %%cr4, %0": "=r"(cr4));
-   cr4 |= 0x00000010;
+   cr4 |= CR4_PSE | CR4_PGE;
    asm volatile("mov %0, %%cr4":: "r"(cr4));
 
    uint32_t cr0;
    asm volatile("mov %%cr0, %0": "=r"(cr0));
-   cr0 |= 0x80000001;
+   // shared text is mapped read only, a kernel write through a user
+   // pointer must fault instead of changing every process running it
+   cr0 |= CR0_PG_PE | CR0_WP;
    asm volatile("mov %0, %%cr0":: "r"(cr0));
 }
 
 /*
  * set_pde
- *   DESCRIPTION: Sets a Page Directory entry to enable paging for
- *                that block of memory and flushes TLB
+ *   DESCRIPTION: Sets an entry of the Page Directory currently loaded
+ *                in CR3 and drops the stale translations. A 4 MB page
+ *                only needs a single invlpg, an entry pointing to a
+ *                Page Table may have left any of its 1024 pages in the
+ *                TLB, so the non-global entries are flushed instead
  *   INPUTS: idx--index of the Page Directory to be written
  *           entry--what the content of the entry of the Page Directory
  *                  should be
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: flushes TLB
+ *   SIDE EFFECTS: flushes TLB entries of the region
  */
 void set_pde(uint32_t idx, uint32_t entry) {
-  pg_drct[idx] = entry;
-
-  // Flush TLB by resetting CR3
-  uint32_t cr3;
-  asm volatile("mov %%cr3, %0":: "r"(cr3));
-  asm volatile("mov %0, %%cr3": "=r"(cr3));
-}
-
-/*
- * change_vid
- *   DESCRIPTION: Changes the entries of the user virtual video memory
- *                for terminal switching and fishs
- *   INPUTS: idx--index of the page table entry to be written
- *           entry--what the content of the entry of the Page Directory
- *                  should be
- *   OUTPUTS: none
- *   RETURN VALUE: none
- *   SIDE EFFECTS: flushes TLB
- */
-void change_vid(uint32_t idx, uint32_t entry) {
-  vid_pg_tbl_1[idx] = entry;
+  uint32_t* pd = cur_pg_drct();
+  uint32_t old = pd[idx];
 
-  // Flush TLB by resetting CR3
-  uint32_t cr3;
-  asm volatile("mov %%cr3, %0":: "r"(cr3));
-  asm volatile("mov %0, %%cr3": "=r"(cr3));
+  pd[idx] = entry;
+  if((old & PDE_PS) && (entry & PDE_PS)) {
+    asm volatile("invlpg (%0)":: "r"(idx << SHIFT_TO_10): "memory");
+  } else {
+    flush_tlb();
+  }
 }
 
-
 /*
  * set_video
  *   DESCRIPTION: Sets the last entry of the Page Directory to be mapped
@@ -161,14 +181,184 @@ void set_video() {
   for(i = 0; i < NUM_ENTRIES; i++) {
     vid_pg_tbl_1[i] = 0x6;                  // clear bit 0 (present), user mode
   }
-  for(i = 0; i < 3; i++) {
-    vid_pg_tbl_1[i] = VIDEO | 0x7;
-                                            // set video memory address VIDEO
+  for(i = 0; i < NUM_TERMINAL; i++) {
+    vid_pg_tbl_1[i] = (TERM_VIDEO + i*TERM_VIDEO_SIZE) | 0x7;
+                                            // set video memory address of terminal i
+                                            // set bit 0 (present)
+                                            // set bits 1 (R/W) and 2 (U/S)
+  }
+
+  flush_tlb();
+}
+
+/*
+ * user_space_init
+ *   DESCRIPTION: Sets up the address space of a process: a Page Directory
+ *                sharing the kernel entries of pg_drct and a Page Table
+ *                for its user memory, both taken from the frame allocator.
+ *                Every user entry is marked not present, frames are only
+ *                allocated when the loader fills a page on its first touch
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the Page Directory address to load into CR3, 0 if
+ *                 memory ran out
+ *   SIDE EFFECTS: none
+ */
+uint32_t user_space_init(void) {
+  int i;
+  uint32_t* pd = (uint32_t*)frame_alloc(0);
+  uint32_t* tbl = (uint32_t*)frame_alloc(0);
+
+  if(pd == NULL || tbl == NULL) {
+    if(pd != NULL) frame_free((uint32_t)pd, 0);
+    if(tbl != NULL) frame_free((uint32_t)tbl, 0);
+    return 0;
+  }
+  for(i = 0; i < NUM_ENTRIES; i++) {
+    tbl[i] = PTE_NOT_PRESENT;
+  }
+  memcpy(pd, pg_drct, sizeof(pg_drct));
+  pd[USER_PDE] = (uint32_t)tbl | 0x7;
                                             // set bit 0 (present)
                                             // set bits 1 (R/W) and 2 (U/S)
+  return (uint32_t)pd;
+}
+
+/*
+ * user_space_free
+ *   DESCRIPTION: Gives the frames of an address space back to the frame
+ *                allocator: every private user page, the Page Table and
+ *                the Page Directory. Shared text frames belong to the
+ *                image cache and are left alone
+ *   INPUTS: pd--Page Directory returned by user_space_init, must not be
+ *               the one loaded in CR3
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void user_space_free(uint32_t pd) {
+  int i;
+  uint32_t* tbl;
+
+  if(pd == 0) return;
+  tbl = (uint32_t*)(((uint32_t*)pd)[USER_PDE] & ADDR_MASK);
+  for(i = 0; i < NUM_ENTRIES; i++) {
+    if((tbl[i] & PTE_PRESENT) && !(tbl[i] & PTE_SHARED)) frame_free(tbl[i] & ADDR_MASK, 0);
   }
+  frame_free((uint32_t)tbl, 0);
+  frame_free(pd, 0);
+}
 
+/*
+ * load_pg_drct
+ *   DESCRIPTION: Switches to the address space of a process with a single
+ *                CR3 load. Kernel pages are global and stay in the TLB
+ *   INPUTS: pd--Page Directory returned by user_space_init
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: flushes the non-global TLB entries if the directory changes
+ */
+void load_pg_drct(uint32_t pd) {
+  if((uint32_t)cur_pg_drct() == pd) return;
+  asm volatile("mov %0, %%cr3":: "r"(pd): "memory");
+}
+
+/*
+ * load_kernel_pg_drct
+ *   DESCRIPTION: Switches to the kernel Page Directory, used while no
+ *                process address space is valid
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: flushes the non-global TLB entries if the directory changes
+ */
+void load_kernel_pg_drct(void) {
+  load_pg_drct((uint32_t)pg_drct);
+}
+
+/*
+ * cur_pg_drct
+ *   DESCRIPTION: Gets the Page Directory currently loaded in CR3
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the Page Directory
+ *   SIDE EFFECTS: none
+ */
+static uint32_t* cur_pg_drct(void) {
   uint32_t cr3;
-  asm volatile("mov %%cr3, %0":: "r"(cr3));
-  asm volatile("mov %0, %%cr3": "=r"(cr3));
+
+  asm volatile("mov %%cr3, %0": "=r"(cr3));
+  return (uint32_t*)(cr3 & ADDR_MASK);
+}
+
+/*
+ * flush_tlb
+ *   DESCRIPTION: Reloads CR3, dropping every TLB entry except the global
+ *                kernel pages
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: flushes TLB
+ */
+static void flush_tlb(void) {
+  uint32_t cr3;
+
+  asm volatile("mov %%cr3, %0\n\t"
+               "mov %0, %%cr3"
+               : "=r"(cr3)
+               :
+               : "memory");
+}
+
+/*
+ * user_page_present
+ *   DESCRIPTION: Checks whether a page of user memory is mapped in the
+ *                Page Table of the running process
+ *   INPUTS: vaddr--virtual address inside the user 4 MB page
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the page is present, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t user_page_present(uint32_t vaddr) {
+  uint32_t* tbl = (uint32_t*)(cur_pg_drct()[USER_PDE] & ADDR_MASK);
+
+  return (tbl[(vaddr >> SHIFT_TO_20) & TBL_IDX_MASK] & PTE_PRESENT) != 0;
+}
+
+/*
+ * map_user_frame
+ *   DESCRIPTION: Points a page of user memory in the Page Table of the
+ *                running process at a given frame. Writable pages are
+ *                private to the process, read only pages are text shared
+ *                through the image cache
+ *   INPUTS: vaddr--virtual address inside the user 4 MB page
+ *           frame--physical address of the 4 kB frame
+ *           writable--nonzero for a private R/W page, zero for a shared
+ *                     read only page
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: invalidates the TLB entry of the page
+ */
+void map_user_frame(uint32_t vaddr, uint32_t frame, uint32_t writable) {
+  uint32_t* tbl = (uint32_t*)(cur_pg_drct()[USER_PDE] & ADDR_MASK);
+
+  tbl[(vaddr >> SHIFT_TO_20) & TBL_IDX_MASK] = (frame & ADDR_MASK) | (writable ? PTE_USER_RW : (PTE_USER_RO | PTE_SHARED));
+  asm volatile("invlpg (%0)":: "r"(vaddr): "memory");
+}
+
+/*
+ * map_time_page
+ *   DESCRIPTION: Maps the time page read only for user code in the last
+ *                entry of the vidmap Page Table. That table is shared by
+ *                every Page Directory, so all processes see the page
+ *   INPUTS: frame--physical address of the kernel's time page
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: invalidates the TLB entry of the page
+ */
+void map_time_page(uint32_t frame) {
+  uint32_t vaddr = USER_VID + TIME_PTE * PAGE_4KB;
+
+  vid_pg_tbl_1[TIME_PTE] = (frame & ADDR_MASK) | PTE_USER_RO;
+  asm volatile("invlpg (%0)":: "r"(vaddr): "memory");
 }
@@ -12,8 +12,20 @@ void paging_init(void);
 void set_pde(uint32_t idx, uint32_t entry);
 /* Set up Page Table Entries for Vidmap */
 void set_video();
-/* Change Page Table Entries for Vidmap when Switching Terminals */
-void change_vid(uint32_t idx, uint32_t entry);
+/* Set up the Page Directory and user Page Table of a process, every user page not present */
+uint32_t user_space_init(void);
+/* Free the frames of an address space */
+void user_space_free(uint32_t pd);
+/* Switch to the address space of a process */
+void load_pg_drct(uint32_t pd);
+/* Switch to the kernel address space */
+void load_kernel_pg_drct(void);
+/* Check whether a user page is present in the current user Page Table */
+int32_t user_page_present(uint32_t vaddr);
+/* Map a user page of the current user Page Table to a given frame */
+void map_user_frame(uint32_t vaddr, uint32_t frame, uint32_t writable);
+/* Map the time page read only at the top of every address space */
+void map_time_page(uint32_t frame);
 
 #endif
 
@@ -1,16 +1,33 @@
 /* pit.c -- Programmable Interval Counter C files
+ *
+ * Channel 0 runs one shot: every interrupt programs the next one, a tick
+ * ahead while tasks are runnable and up to the next timer while the idle
+ * task halts. Tick numbers come from the TSC clock, so an interrupt that
+ * covered several ticks accounts for all of them
  */
 
 #include "pit.h"
+#include "clock.h"
+#include "timer.h"
 
-#define CMD_Content	0x36
+#define CMD_ONESHOT	0x30		// channel 0, lobyte/hibyte, mode 0
 #define CMD_PORT 	0x43
 #define TOTAL_FREQ	1193182
 #define Channel0	0x40
 #define LASTBYTE	0xFF
 #define LEN_BYTE	0x8
+#define MAX_COUNT	0xFFFF
+#define NS_PER_SEC	1000000000
 #define PIT_IRQ 	0
 
+// length of a tick in nanoseconds
+static uint32_t tick_ns;
+// most ticks a single count reaches
+static uint32_t max_ticks;
+
+/* Helper function that computes a * b / c with a 64-bit intermediate */
+static uint32_t mul_div(uint32_t a, uint32_t b, uint32_t c);
+
 
 /*
  * pit_init
@@ -21,16 +38,15 @@
  *   SIDE EFFECTS: none
  */
 void pit_init(int32_t freq) {
+	tick_ns = NS_PER_SEC / freq;
+	max_ticks = MAX_COUNT / (TOTAL_FREQ / freq);
 
-	//first we tell the pit which channel we're setting
-	outb(CMD_Content, CMD_PORT);
-
-	int divisor = TOTAL_FREQ / freq;
+	//user code reads the rate from the time page
+	clock_set_hz(freq);
+	jiffies = clock_jiffies(NULL);
 
-	//we first send low byte
-	outb((uint8_t)(divisor & LASTBYTE), Channel0);
-	//then send high byte
-	outb((uint8_t)((divisor >> LEN_BYTE) & LASTBYTE), Channel0);
+	//the first interrupt comes a tick from now
+	pit_oneshot(1);
 
 	//finally we enable the pit interrupt
 	enable_irq(PIT_IRQ);
@@ -46,9 +62,88 @@ void pit_init(int32_t freq) {
  *   SIDE EFFECTS: take some actions specified by the scheduler for each interrupt
  */
 void pit_handler(void) {
-	//printf("a ");
 	send_eoi(PIT_IRQ);
+	pit_update();
+	//time slices keep going, the idle task stops them again
+	pit_oneshot(1);
 	//trigger the scheduler function for each interrupt
 	sched();
 }
 
+
+/*
+ * pit_update
+ *   DESCRIPTION: Brings jiffies up to the TSC clock. The ticks that passed
+ *                since the last update are charged to the running task,
+ *                published in the time page and the timers due by now fire
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts off
+ */
+void pit_update(void) {
+	uint32_t now = clock_jiffies(NULL);
+
+	if((int32_t)(now - jiffies) <= 0) return;
+	//account the ticks to whatever was running
+	sched_tick(now - jiffies);
+	jiffies = now;
+	clock_tick(jiffies);
+	//fire the timers that came due, woken tasks are queued before sched
+	timer_run(jiffies);
+}
+
+
+/*
+ * pit_oneshot
+ *   DESCRIPTION: Programs channel 0 to interrupt once at a tick boundary.
+ *                Counts are capped at MAX_COUNT, a longer wait wakes up
+ *                early and is programmed again
+ *   INPUTS: ticks--ticks from jiffies to interrupt at, 0 stops channel 0
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts off
+ */
+void pit_oneshot(uint32_t ticks) {
+	uint32_t now, into, count;
+	int32_t delta;
+
+	//the mode command alone holds the counter until a count is written
+	outb(CMD_ONESHOT, CMD_PORT);
+	if(ticks == 0) return;
+
+	if(ticks > max_ticks) ticks = max_ticks;
+	//ticks left to the target, counted modulo 2^32 like jiffies
+	now = clock_jiffies(&into);
+	delta = (int32_t)(jiffies + ticks - now);
+	if(delta <= 0) count = 1;
+	else count = mul_div(delta * tick_ns - into, TOTAL_FREQ, NS_PER_SEC) + 1;
+	if(count > MAX_COUNT) count = MAX_COUNT;
+
+	//we first send low byte
+	outb((uint8_t)(count & LASTBYTE), Channel0);
+	//then send high byte
+	outb((uint8_t)((count >> LEN_BYTE) & LASTBYTE), Channel0);
+}
+
+
+/*
+ * mul_div
+ *   DESCRIPTION: Computes a * b / c, the product is kept in edx:eax so
+ *                it may exceed 32 bits as long as the quotient does not
+ *   INPUTS: a, b--factors
+ *           c--divisor
+ *   OUTPUTS: none
+ *   RETURN VALUE: the quotient
+ *   SIDE EFFECTS: none
+ */
+static uint32_t mul_div(uint32_t a, uint32_t b, uint32_t c) {
+	uint32_t q, r;
+
+	asm volatile("mull %3\n\t"
+				"divl %4"
+				: "=a"(q), "=&d"(r)
+				: "a"(a), "r"(b), "r"(c)
+				: "cc");
+	return q;
+}
@@ -17,12 +17,23 @@
 #include "terminal.h"
 #include "scheduler.h"
 
+#define PIT_HZ			100		// rate the PIT interrupts at
+
+/* PIT ticks since pit_init */
+volatile uint32_t jiffies;
+
 /* Initialize the Programmable Interval Timer */
 void pit_init(int32_t freq);
 
 /* Handle the pit interrupt */
 void pit_handler(void);
 
+/* Catch jiffies up with the clock and run what came due */
+void pit_update(void);
+
+/* Program the next interrupt some ticks ahead, 0 for none */
+void pit_oneshot(uint32_t ticks);
+
 #endif
 
 #endif
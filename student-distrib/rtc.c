@@ -3,6 +3,9 @@
 
 #include "rtc.h"
 #include "terminal.h"
+#include "scheduler.h"
+#include "syscall.h"
+#include "slab.h"
 
 #include "types.h"
 #include "i8259.h"
@@ -24,28 +27,46 @@
 #define LOWER_FREQ					2
 #define FAIL 						-1
 #define DOUBLE 						2
-#define NUM_TERM 					3
-
-
-/* Flag that indicates if an interrupt has occured */
-volatile uint32_t rtc_int_flag[NUM_TERM];
+#define BASE_FREQ					32768
+#define NO_SLOT						0			// fd inode of an RTC without a slot yet
+
+// A virtual RTC, one per open RTC descriptor, taken from a slab cache
+typedef struct rtc_slot_t {
+	struct rtc_slot_t* next;	// list of the slots in use
+	uint32_t freq;			// rate asked for through rtc_write
+	uint32_t period;		// hardware interrupts per virtual tick
+	uint32_t count;			// hardware interrupts since the last tick
+	volatile int ticked;	// set by the handler, cleared by rtc_read
+	wait_queue_t wait;		// the task in rtc_read on this slot
+} rtc_slot_t;
+
+/* Slots in use, the handler walks them */
+static rtc_slot_t* rtc_slots;
+/* Cache the slots come from, made on first use since rtc_init runs before slab_init */
+static kmem_cache_t* rtc_slot_cache;
+/* Rate the hardware runs at, 0 while nobody has the RTC open */
+static uint32_t hw_freq;
+
+/* Slot behind an RTC descriptor, given one on first use */
+static rtc_slot_t* rtc_slot(int32_t fd);
+/* Constructor of the slot cache */
+static void rtc_slot_ctor(void* obj);
+/* Run the hardware at the highest rate asked for */
+static void rtc_update_rate(rtc_slot_t* changed);
 
 /*
  * rtc_init
- *   DESCRIPTION: initializes the RTC and changes the rate
- *                also enables IRQs for RTC
+ *   DESCRIPTION: initializes the RTC, turns on periodic interrupts
+ *                at the slowest rate. The IRQ stays masked until a
+ *                program has the RTC open
  *   INPUTS: none
  *   OUTPUTS: none
- *   RETURN VALUE: ASCII value of the character typed in
+ *   RETURN VALUE: none
  *   SIDE EFFECTS: none
  */
 void rtc_init(void) {
 	//mask the interrupt for initialization
 	cli();
-	int i;
-	//change our flag to 0 during initialization
-	for (i = 0; i < NUM_TERM; i++) rtc_int_flag[i] = 0;
-
 	uint8_t val = 0;
 	//according to osdev, we have to disable NMI here
 	outb(RTC_REGB, RTC_CMD_PORT);
@@ -60,8 +81,7 @@ void rtc_init(void) {
 
 	//change the interrupt rate to 2 here
 	rtc_change_rate(Test_rate);
-
-	enable_irq(RTC_IRQ);
+	hw_freq = 0;
 
 	//set the interrupt
 	sti();
@@ -97,8 +117,9 @@ rtc_change_rate(uint8_t rate) {
 /*
  * rtc_handler
  *   DESCRIPTION: handler for when interrupt for RTC is 
- *                raised (calls test_interrupts program for
- *                testing) and sends EOI when finished
+ *                raised, counts the interrupt against every
+ *                open RTC and wakes the ones whose virtual
+ *                period is over, then sends EOI
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
@@ -106,6 +127,7 @@ rtc_change_rate(uint8_t rate) {
  */
 void
 rtc_handler(void) {
+	rtc_slot_t* slot;
 	cli();
 
 	outb(RTC_REGC, RTC_CMD_PORT);
@@ -113,9 +135,12 @@ rtc_handler(void) {
 	//check point 1 test 
 	//test_interrupts();
 
-	//clear the flag to indicate a new interrupt has occured
-	int i;
-	for (i = 0; i < NUM_TERM; i++) rtc_int_flag[i] = 0;
+	for (slot = rtc_slots; slot != NULL; slot = slot->next) {
+		if (++slot->count < slot->period) continue;
+		slot->count = 0;
+		slot->ticked = 1;
+		wake_up(&slot->wait);
+	}
 	send_eoi(RTC_IRQ);
 
 	sti();
@@ -124,68 +149,76 @@ rtc_handler(void) {
 
 /*
  * rtc_open
- *   DESCRIPTION: open rtc by initialization
+ *   DESCRIPTION: open rtc, the descriptor gets its virtual RTC
+ *                the first time it is read or written
  *   INPUTS: filename pointer - do nothing here
  *   OUTPUTS: a number indicating if we succeed
  *   RETURN VALUE: 0 - success
- *   SIDE EFFECTS: open rtc by initialization
+ *   SIDE EFFECTS: none
  */
 int32_t rtc_open(const uint8_t* filename) {
-	//we really have nothing to do except initialization
-	rtc_init();
 	return 0;
 }
 
 
 /*
  * rtc_read
- *   DESCRIPTION: wait for one tick of the time that indicated
- *				  by the rtc rate
- *   INPUTS: int fd - do nothing here
+ *   DESCRIPTION: wait for one tick of the rate set on this
+ *				  descriptor
+ *   INPUTS: int fd - the RTC descriptor
  *			 buf pointer - do nothing here
  *			 int nbytes - do nothing here
  *   OUTPUTS: a number indicating if we succeed
- *   RETURN VALUE: 0 - success
+ *   RETURN VALUE: 0 - success, -1 if no virtual RTC is left
  *   SIDE EFFECTS: wait for one tick of time depending on rtc rate
  */
 int32_t rtc_read(int32_t fd, void* buf, int32_t nbytes) {
-	//set a flag to show that we are waiting for an interrupt
-	rtc_int_flag[processing_terminal] = 1;
-	//wait for next interrupt changes it back to 0
-	while (rtc_int_flag[processing_terminal]);
+	rtc_slot_t* slot;
+
+	cli();
+	slot = rtc_slot(fd);
+	if (slot == NULL) {
+		sti();
+		return FAIL;
+	}
+	//sleep until the handler sees our period go by
+	slot->ticked = 0;
+	while (!slot->ticked) sleep_on(&slot->wait);
+	sti();
 	return 0;
 }
 
 
 /*
  * rtc_write
- *   DESCRIPTION: write to rtc by changing the rate
- *   INPUTS: int fd - do nothing here
+ *   DESCRIPTION: set the rate of this descriptor, the hardware
+ *                only speeds up if no one asked for as much yet
+ *   INPUTS: int fd - the RTC descriptor
  *			 buf pointer - points to a number indicating the new frequency
  *			 int nbytes - do nothing here
  *   OUTPUTS: a number indicating if we succeed
- *   RETURN VALUE: 0 - success
- *   SIDE EFFECTS: change the rate of the rtc
+ *   RETURN VALUE: 0 - success, -1 on a bad frequency
+ *   SIDE EFFECTS: may change the rate of the rtc
  */
 int32_t rtc_write(int32_t fd, const void* buf, int32_t nbytes) {
+	rtc_slot_t* slot;
+
 	//sanity check, complain if null is passed
 	if (buf == NULL) return FAIL;
 	//documentation tells us the thing in buf is a 4-byte int
 	int32_t freq = *((int32_t*)buf);
-	//check if the freq we get is within the range
-	if (freq > UPPER_FREQ || freq < LOWER_FREQ) return FAIL;
-	//initially start from 15
-	uint8_t rate = Test_rate;
-	//formulas from osdev to transfer freq to rate
-	while (freq != DOUBLE) {
-		freq /= DOUBLE;
-		rate--;
-		//protect the situation where 3 appears
-		if (freq < DOUBLE) return FAIL;
-	}
+	//check if the freq we get is within the range and a power of two
+	if (freq > UPPER_FREQ || freq < LOWER_FREQ || (freq & (freq - 1))) return FAIL;
 
-	//here our rate argument is guaranteed to make sense
-	rtc_change_rate(rate);
+	cli();
+	slot = rtc_slot(fd);
+	if (slot == NULL) {
+		sti();
+		return FAIL;
+	}
+	slot->freq = freq;
+	rtc_update_rate(slot);
+	sti();
 
 	//return 0 upon sucess
 	return 0;
@@ -194,15 +227,127 @@ int32_t rtc_write(int32_t fd, const void* buf, int32_t nbytes) {
 
 /*
  * rtc_close
- *   DESCRIPTION: close the rtc
- *   INPUTS: int fd - do nothing here
+ *   DESCRIPTION: close the rtc, gives its virtual RTC back and
+ *                slows the hardware down if it ran that fast
+ *                only for this descriptor
+ *   INPUTS: int fd - the RTC descriptor
  *   OUTPUTS: a number indicating if we succeed
  *   RETURN VALUE: 0 - success
  *   SIDE EFFECTS: none
  */
 int32_t rtc_close(int32_t fd) {
+	pcb_t* curr_pcb = get_pcb(terminal[processing_terminal].cur_pid);
+	rtc_slot_t* slot = (rtc_slot_t*)curr_pcb->f_array[fd].inode;
+	rtc_slot_t** link;
+	uint32_t flags;
+
+	if (slot == NO_SLOT) return 0;
+	//halt closes files with interrupts off, keep them that way
+	cli_and_save(flags);
+	for (link = &rtc_slots; *link != slot; link = &(*link)->next);
+	*link = slot->next;
+	//nobody waits on a closed descriptor, the slot goes back constructed
+	kmem_cache_free(rtc_slot_cache, slot);
+	curr_pcb->f_array[fd].inode = NO_SLOT;
+	rtc_update_rate(NULL);
+	restore_flags(flags);
 	return 0;
 }
 
 
+/*
+ * rtc_slot
+ *   DESCRIPTION: finds the virtual RTC of a descriptor, a pointer
+ *                to it is kept in the inode field of the fd. A
+ *                new one starts at 2 Hz like the hardware used to
+ *   INPUTS: int fd - the RTC descriptor
+ *   OUTPUTS: none
+ *   RETURN VALUE: the slot, NULL if memory ran out
+ *   SIDE EFFECTS: called with interrupts off
+ */
+static rtc_slot_t* rtc_slot(int32_t fd) {
+	pcb_t* curr_pcb = get_pcb(terminal[processing_terminal].cur_pid);
+	rtc_slot_t* slot = (rtc_slot_t*)curr_pcb->f_array[fd].inode;
 
+	if (slot != NO_SLOT) return slot;
+
+	if (rtc_slot_cache == NULL) {
+		rtc_slot_cache = kmem_cache_create("rtc_slot", sizeof(rtc_slot_t), rtc_slot_ctor);
+	}
+	slot = kmem_cache_alloc(rtc_slot_cache);
+	if (slot == NULL) return NULL;
+
+	slot->freq = LOWER_FREQ;
+	slot->ticked = 0;
+	slot->next = rtc_slots;
+	rtc_slots = slot;
+	curr_pcb->f_array[fd].inode = (uint32_t)slot;
+	rtc_update_rate(slot);
+	return slot;
+}
+
+
+/*
+ * rtc_slot_ctor
+ *   DESCRIPTION: constructor of the slot cache, a slot is handed
+ *                out and given back with nobody on its wait queue
+ *   INPUTS: obj - the slot
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void rtc_slot_ctor(void* obj) {
+	rtc_slot_t* slot = (rtc_slot_t*)obj;
+
+	slot->wait.head = NULL;
+	slot->wait.tail = NULL;
+}
+
+
+/*
+ * rtc_update_rate
+ *   DESCRIPTION: programs the hardware for the fastest virtual RTC,
+ *                every other one counts that many interrupts per
+ *                tick. With none open the IRQ is masked. Only the
+ *                changed slot starts a fresh period, the others keep
+ *                their progress, rescaled if the hardware rate moved
+ *   INPUTS: changed - slot opened or given a new rate, NULL if one
+ *                     was just closed
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called with interrupts off
+ */
+static void rtc_update_rate(rtc_slot_t* changed) {
+	uint32_t freq = 0;
+	uint32_t old_freq = hw_freq;
+	uint32_t period;
+	uint8_t rate;
+	rtc_slot_t* slot;
+
+	for (slot = rtc_slots; slot != NULL; slot = slot->next) {
+		if (slot->freq > freq) freq = slot->freq;
+	}
+
+	if (freq != hw_freq) {
+		if (freq == 0) {
+			disable_irq(RTC_IRQ);
+		} else {
+			//formulas from osdev, freq = 32768 >> (rate - 1)
+			for (rate = 1; (BASE_FREQ >> (rate - 1)) > freq; rate++);
+			rtc_change_rate(rate);
+			if (hw_freq == 0) enable_irq(RTC_IRQ);
+		}
+		hw_freq = freq;
+	}
+
+	for (slot = rtc_slots; slot != NULL; slot = slot->next) {
+		period = hw_freq / slot->freq;
+		if (slot == changed) {
+			slot->count = 0;
+		} else if (hw_freq != old_freq) {
+			//same share of the period done, counted in the new interrupts
+			slot->count = slot->count * period / slot->period;
+		}
+		slot->period = period;
+	}
+}
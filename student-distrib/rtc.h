@@ -8,8 +8,6 @@
 
 #ifndef ASM
 
-#define NUM_TERM 					3
-
 /* Initialize RTC */
 void rtc_init(void);
 
@@ -19,10 +17,7 @@ void rtc_change_rate(uint8_t rate);
 /* RTC handler, called when interrupt is raised */
 void rtc_handler(void);
 
-/* Flag that indicates if an interrupt has occured */
-volatile uint32_t rtc_int_flag[NUM_TERM];
-
-/* Open rtc by initialization */
+/* Open rtc, the virtual RTC is set up on first use */
 int32_t rtc_open(const uint8_t* filename);
 
 /* Wait for one tick of the time that indicated by the rtc rate */
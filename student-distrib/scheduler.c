@@ -3,57 +3,447 @@
 
 #include "scheduler.h"
 #include "terminal.h"
+#include "timer.h"
 
-#define VIRTUAL_ADDR	0x08048000
-#define SHIFT_4MB 		22
+// Magic Numbers
+#define TICKS_PER_SEC	PIT_HZ
+#define PERCENT			100
+
+// Run queue: circular list of the runnable tasks, the running one included
+static pcb_t* run_queue;
+// the boot context, runs whenever the run queue is empty and is never queued
+static pcb_t idle_task;
+// terminal spawn_shell opens a shell on
+static int spawn_term;
+// CPU accounting over the current one second window
+static uint32_t window_ticks;
+static uint32_t window_idle;
+static uint32_t cpu_load;
+
+// Local functions
+static void schedule(void);
+static pcb_t* pick_next(void);
+static void rq_insert(pcb_t* task);
+static void switch_to(pcb_t* next);
+static void switch_context(uint32_t* save_esp, uint32_t esp);
+static void spawn_context(uint32_t* save_esp);
+static void spawn_shell(void);
+static uint32_t idle_ticks(void);
+
+/*
+ * sched_init
+ *   DESCRIPTION: Makes the boot context the idle task, it is the current
+ *                task until the first process starts
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void sched_init(void) {
+	memset(&idle_task, 0, sizeof(idle_task));
+	idle_task.pid = -1;
+	idle_task.esp0 = tss.esp0;
+	run_queue = NULL;
+	cur_task = &idle_task;
+	window_ticks = 0;
+	window_idle = 0;
+	cpu_load = 0;
+}
+
+/*
+ * cpu_idle
+ *   DESCRIPTION: Body of the idle task. Halts until an interrupt arrives
+ *                and switches away as soon as a handler made a task
+ *                runnable, so a woken reader does not wait for the next
+ *                tick. While nothing runs the PIT only fires for the next
+ *                timer, leaving idle restarts the time slices.
+ *                sti;hlt cannot lose an interrupt between the two
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: never returns
+ *   SIDE EFFECTS: none
+ */
+void cpu_idle(void) {
+	while(1) {
+		cli();
+		if(pick_next() != NULL) {
+			// the halted ticks are charged to the idle task
+			pit_update();
+			pit_oneshot(1);
+			schedule();
+			continue;
+		}
+		pit_oneshot(idle_ticks());
+		asm volatile("sti; hlt");
+	}
+}
+
+/*
+ * idle_ticks
+ *   DESCRIPTION: Decides when the idle task needs the next PIT interrupt:
+ *                every tick while sched still has shells to start, at the
+ *                next timer otherwise, never if no timer is pending
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: ticks until the interrupt, 0 for none
+ *   SIDE EFFECTS: none
+ */
+static uint32_t idle_ticks(void) {
+	int i;
+
+	for(i = 0; i < NUM_TERMINAL; i++) {
+		if(terminal[i].num_process == 0) return 1;
+	}
+	return timer_next(jiffies);
+}
+
+/*
+ * sched_tick
+ *   DESCRIPTION: Charges the PIT ticks since the last call to the running
+ *                task, the idle task's count is the system idle time. Once
+ *                a second has passed the share of non idle ticks becomes
+ *                the CPU load
+ *   INPUTS: ticks--ticks that passed
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called from pit_update with interrupts off
+ */
+void sched_tick(uint32_t ticks) {
+	cur_task->ticks += ticks;
+	window_ticks += ticks;
+	if(cur_task == &idle_task) window_idle += ticks;
+	if(window_ticks >= TICKS_PER_SEC) {
+		cpu_load = PERCENT - window_idle * PERCENT / window_ticks;
+		window_ticks = 0;
+		window_idle = 0;
+	}
+}
+
+/*
+ * sched_cpu_load
+ *   DESCRIPTION: Gets the CPU utilization of the last full second
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: busy percentage, 0-100
+ *   SIDE EFFECTS: none
+ */
+uint32_t sched_cpu_load(void) {
+	return cpu_load;
+}
+
+/*
+ * sched_idle_ticks
+ *   DESCRIPTION: Gets the number of ticks spent in the idle task since boot
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: idle tick count
+ *   SIDE EFFECTS: none
+ */
+uint32_t sched_idle_ticks(void) {
+	return idle_task.ticks;
+}
+
+/*
+ * set_kernel_stack
+ *   DESCRIPTION: Sets the kernel stack the processor switches to when the
+ *                running task enters the kernel. SYSENTER picks it up from
+ *                the TSS too, so the MSR is not rewritten on every switch
+ *   INPUTS: esp0--top of the task's kernel stack
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void set_kernel_stack(uint32_t esp0) {
+	tss.esp0 = esp0;
+}
 
 /*
  * sched
  *   DESCRIPTION: sched is run every time the pit is fired: first if no process
- *                is running on that particular terminal, execute shell. Then,
- *                save the esp and ebp of the currently running process. Then, 
- *                change the processing terminal into the next terminal and 
- *                update to the esp, ebp, esp0 in TSS, as well as paging of the
- *                next terminal
+ *                is running on a terminal, a shell is opened there. Otherwise
+ *                the task after the current one in the run queue gets the
+ *                processor. Only runnable tasks are queued, a parent waiting
+ *                in execute is not, so no time slice is spent on it
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: prepares the stack for the next program in the sched queue
+ *   SIDE EFFECTS: switches kernel stack, TSS esp0 and address space
  */
 void sched()
 {
+	int i;
+
 	cli();
-	next_terminal = (processing_terminal+1)%3;
-	// save esp and ebp
-    asm volatile("movl %%esp, %0\n\t"
-				"movl %%ebp, %1\n\t"
-				:"=r"(terminal[processing_terminal].esp), "=r"(terminal[processing_terminal].ebp)
-				);
-	//open a new shell for each terminal
-	if(terminal[next_terminal].num_process == 0)
-	{
-		processing_terminal = next_terminal;
-		//terminal[processing_terminal].num_process++;
-		sti();
-		execute((uint8_t*)"shell");
+	//open a new shell for each terminal, one per tick
+	for(i = 0; i < NUM_TERMINAL; i++) {
+		if(terminal[i].num_process == 0) {
+			spawn_term = i;
+			spawn_context(&cur_task->sched_esp);
+			return;
+		}
+	}
+
+	schedule();
+}
+
+/*
+ * sleep_on
+ *   DESCRIPTION: Blocks the current task until wake_up is called on the
+ *                queue. The caller checks its condition with interrupts
+ *                off and sleeps again if it still does not hold, so a
+ *                wake up between the check and the sleep is not lost
+ *   INPUTS: wq--queue to wait on
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts off, returns with them off
+ */
+void sleep_on(wait_queue_t* wq) {
+	pcb_t* task = cur_task;
+
+	if(task == &idle_task) {
+		// kernel code before the first process: just wait for an interrupt
+		asm volatile("sti; hlt; cli");
 		return;
 	}
+	task->wait_next = NULL;
+	if(wq->tail != NULL) wq->tail->wait_next = task;
+	else wq->head = task;
+	wq->tail = task;
+	sched_remove(task);
+	schedule();
+}
 
-	processing_terminal = next_terminal;
+/*
+ * wake_up
+ *   DESCRIPTION: Puts every task sleeping on a queue back in the run queue,
+ *                called from interrupt handlers
+ *   INPUTS: wq--queue to wake
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void wake_up(wait_queue_t* wq) {
+	uint32_t flags;
+	pcb_t* task;
 
-	pcb_t* cur_pcb = get_pcb(terminal[processing_terminal].cur_pid);
+	cli_and_save(flags);
+	while(wq->head != NULL) {
+		task = wq->head;
+		wq->head = task->wait_next;
+		task->wait_next = NULL;
+		if(!task->on_rq) rq_insert(task);
+	}
+	wq->tail = NULL;
+	restore_flags(flags);
+}
+
+/*
+ * schedule
+ *   DESCRIPTION: Switches to the next runnable task, or to the idle task
+ *                when every task is blocked
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts off
+ */
+static void schedule(void) {
+	pcb_t* next = pick_next();
+
+	if(next == NULL) next = &idle_task;
+	if(next != cur_task) switch_to(next);
+}
 
+/*
+ * sched_replace
+ *   DESCRIPTION: Puts a task in the run queue and makes it the current
+ *                task. If old is queued the task takes its place (execute
+ *                blocks the parent, halt wakes it), otherwise the task is
+ *                added right after the current one
+ *   INPUTS: old--task to take the place of, may be NULL
+ *           task--task to run
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts off, sets processing_terminal
+ */
+void sched_replace(pcb_t* old, pcb_t* task) {
+	if(old != NULL && old->on_rq) {
+		if(old->next == old) {
+			task->next = task;
+			task->prev = task;
+		} else {
+			task->next = old->next;
+			task->prev = old->prev;
+			old->prev->next = task;
+			old->next->prev = task;
+		}
+		if(run_queue == old) run_queue = task;
+		old->on_rq = 0;
+		task->on_rq = 1;
+	} else {
+		rq_insert(task);
+	}
+	cur_task = task;
+	processing_terminal = task->term;
+}
+
+/*
+ * sched_remove
+ *   DESCRIPTION: Takes a task off the run queue
+ *   INPUTS: task--task to remove, ignored if not queued
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts off
+ */
+void sched_remove(pcb_t* task) {
+	if(!task->on_rq) return;
+	if(task->next == task) {
+		run_queue = NULL;
+	} else {
+		task->prev->next = task->next;
+		task->next->prev = task->prev;
+		if(run_queue == task) run_queue = task->next;
+	}
+	task->on_rq = 0;
+}
+
+/*
+ * pick_next
+ *   DESCRIPTION: Chooses the task to run next: the one after the current
+ *                task, or the head of the queue if the current task has
+ *                left it
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the task, NULL if the queue is empty
+ *   SIDE EFFECTS: none
+ */
+static pcb_t* pick_next(void) {
+	if(cur_task != NULL && cur_task->on_rq) return cur_task->next;
+	return run_queue;
+}
+
+/*
+ * rq_insert
+ *   DESCRIPTION: Adds a task to the run queue after the current task
+ *   INPUTS: task--task to add
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void rq_insert(pcb_t* task) {
+	pcb_t* anchor = (cur_task != NULL && cur_task->on_rq) ? cur_task : run_queue;
+
+	if(anchor == NULL) {
+		task->next = task;
+		task->prev = task;
+		run_queue = task;
+	} else {
+		task->next = anchor->next;
+		task->prev = anchor;
+		anchor->next->prev = task;
+		anchor->next = task;
+	}
+	task->on_rq = 1;
+}
+
+/*
+ * switch_to
+ *   DESCRIPTION: Hands the processor to another task: sets TSS esp0 and
+ *                the address space for it, then swaps kernel stacks. Returns
+ *                when the current task is picked again
+ *   INPUTS: next--task to run
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts off
+ */
+static void switch_to(pcb_t* next) {
+	uint32_t* save_esp = &cur_task->sched_esp;
+
+	cur_task = next;
+	processing_terminal = next->term;
 	// change TSS esp0
-	tss.esp0 = cur_pcb->esp0;
-	// change PD
-	uint32_t virt_addr = VIRTUAL_ADDR;
-	uint32_t phys_addr = cur_pcb->pd_entry;
-	set_pde(virt_addr >> SHIFT_4MB, phys_addr);
-	// change esp and ebp
-	asm volatile("movl %0, %%esp\n\t"
-				"movl %1, %%ebp\n\t"
+	set_kernel_stack(next->esp0);
+	// change address space, kernel pages are global and survive the CR3 load.
+	// The idle task has none and keeps whichever one is loaded
+	if(next->pg_drct != 0) load_pg_drct(next->pg_drct);
+	switch_context(save_esp, next->sched_esp);
+}
+
+/*
+ * switch_context
+ *   DESCRIPTION: Saves the callee saved registers and a resume address on
+ *                the current kernel stack, stores the stack pointer and
+ *                continues on another saved stack
+ *   INPUTS: save_esp--where to store the current stack pointer
+ *           esp--stack pointer saved by switch_context or spawn_context
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: returns only when switched back to
+ */
+static void switch_context(uint32_t* save_esp, uint32_t esp) {
+	asm volatile("pushl %%ebp\n\t"
+				"pushl %%ebx\n\t"
+				"pushl %%esi\n\t"
+				"pushl %%edi\n\t"
+				"pushl $1f\n\t"
+				"movl %%esp, (%0)\n\t"
+				"movl %1, %%esp\n\t"
+				"ret\n"
+				"1:\n\t"
+				"popl %%edi\n\t"
+				"popl %%esi\n\t"
+				"popl %%ebx\n\t"
+				"popl %%ebp\n\t"
+				:
+				:"a"(save_esp), "c"(esp)
+				:"memory", "edx"
+				);
+}
+
+/*
+ * spawn_context
+ *   DESCRIPTION: Saves the current task the same way switch_context does,
+ *                then starts a shell further down the same stack. The
+ *                saved task resumes here once it is picked again
+ *   INPUTS: save_esp--where to store the current stack pointer
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: returns only when switched back to
+ */
+static void spawn_context(uint32_t* save_esp) {
+	asm volatile("pushl %%ebp\n\t"
+				"pushl %%ebx\n\t"
+				"pushl %%esi\n\t"
+				"pushl %%edi\n\t"
+				"pushl $1f\n\t"
+				"movl %%esp, (%0)\n\t"
+				"call *%1\n"
+				"1:\n\t"
+				"popl %%edi\n\t"
+				"popl %%esi\n\t"
+				"popl %%ebx\n\t"
+				"popl %%ebp\n\t"
 				:
-				:"g"(terminal[processing_terminal].esp), "g"(terminal[processing_terminal].ebp)
+				:"a"(save_esp), "c"(spawn_shell)
+				:"memory", "edx"
 				);
-	sti();
+}
+
+/*
+ * spawn_shell
+ *   DESCRIPTION: Opens the shell of a terminal, execute does not return
+ *                unless the shell cannot be started, in which case the
+ *                interrupted task continues and the next tick tries again
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void spawn_shell(void) {
+	uint32_t dead_esp;
+
+	processing_terminal = spawn_term;
+	execute((uint8_t*)"shell");
+
+	processing_terminal = cur_task->term;
+	switch_context(&dead_esp, cur_task->sched_esp);
 }
@@ -17,8 +17,38 @@
 #include "syscall.h"
 
 volatile int sched_term;
+// task running on the processor
+pcb_t* cur_task;
+// set at boot when the processor supports SYSENTER/SYSEXIT
+uint32_t sysenter_enabled;
 
+// tasks blocked until an event, woken in the order they went to sleep
+typedef struct wait_queue_t {
+	pcb_t* head;
+	pcb_t* tail;
+} wait_queue_t;
+
+/* Make the boot context the idle task */
+void sched_init(void);
+/* Idle task body, never returns */
+void cpu_idle(void);
+/* Charge PIT ticks to the running task */
+void sched_tick(uint32_t ticks);
+/* CPU utilization of the last second in percent */
+uint32_t sched_cpu_load(void);
+/* Ticks spent idle since boot */
+uint32_t sched_idle_ticks(void);
+/* Point TSS esp0 and the SYSENTER stack at a task's kernel stack */
+void set_kernel_stack(uint32_t esp0);
 /* Main body of the scheduler program */
 void sched();
+/* Queue a task in place of another one and make it current */
+void sched_replace(pcb_t* old, pcb_t* task);
+/* Take a task off the run queue */
+void sched_remove(pcb_t* task);
+/* Block the current task on a wait queue until it is woken */
+void sleep_on(wait_queue_t* wq);
+/* Make every task of a wait queue runnable again */
+void wake_up(wait_queue_t* wq);
 
 #endif
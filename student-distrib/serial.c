@@ -0,0 +1,260 @@
+/* serial.c - interrupt driven 16550 UART on COM1, used as a device and
+ * as a copy of everything printf puts on the screen
+ */
+
+#include "serial.h"
+#include "scheduler.h"
+
+#include "types.h"
+#include "i8259.h"
+#include "lib.h"
+
+// Magic Numbers
+#define COM1                0x3F8
+#define SERIAL_IRQ          4
+#define REG_DATA            0           // registers, offsets from COM1
+#define REG_IER             1
+#define REG_IIR             2
+#define REG_FCR             2
+#define REG_LCR             3
+#define REG_MCR             4
+#define REG_LSR             5
+#define REG_MSR             6
+#define DIVISOR_LOW         0           // with DLAB set
+#define DIVISOR_HIGH        1
+#define BAUD_DIVISOR        1           // 115200 baud
+#define LCR_8N1             0x03
+#define LCR_DLAB            0x80
+#define FCR_ENABLE          0xC7        // enable and clear FIFOs, 14 byte rx trigger
+#define MCR_OUT2            0x0B        // DTR, RTS and OUT2, which gates the IRQ
+#define IER_RX              0x01
+#define IER_TX              0x02
+#define IIR_NO_INT          0x01
+#define IIR_ID              0x0E
+#define IIR_TX              0x02
+#define IIR_RX              0x04
+#define IIR_LINE            0x06
+#define IIR_TIMEOUT         0x0C
+#define LSR_DATA            0x01
+#define FIFO_SIZE           16
+#define TX_SIZE             4096        // rings are powers of two
+#define RX_SIZE             256
+
+/* Bytes waiting for the transmitter, kernel output is dropped when full */
+static uint8_t tx_buf[TX_SIZE];
+static volatile uint32_t tx_head;
+static volatile uint32_t tx_tail;
+/* Set while the transmitter has a FIFO load to send */
+static volatile int tx_busy;
+/* Bytes received and not read yet */
+static uint8_t rx_buf[RX_SIZE];
+static volatile uint32_t rx_head;
+static volatile uint32_t rx_tail;
+/* Tasks waiting in serial_read for input */
+static wait_queue_t rx_wait;
+/* Set once the UART is programmed, output before that waits in the ring */
+static int serial_ready;
+
+/* Hand the transmitter up to a FIFO load from the ring */
+static void tx_start(void);
+/* Move the received bytes into the ring */
+static void rx_drain(void);
+
+/*
+ * serial_init
+ *   DESCRIPTION: Programs COM1 for 115200 8N1 with FIFOs and unmasks its
+ *                IRQ, output queued during boot starts going out
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void serial_init(void) {
+    uint32_t flags;
+
+    cli_and_save(flags);
+    outb(0, COM1 + REG_IER);
+    outb(LCR_DLAB, COM1 + REG_LCR);
+    outb(BAUD_DIVISOR & 0xFF, COM1 + DIVISOR_LOW);
+    outb(BAUD_DIVISOR >> 8, COM1 + DIVISOR_HIGH);
+    outb(LCR_8N1, COM1 + REG_LCR);
+    outb(FCR_ENABLE, COM1 + REG_FCR);
+    outb(MCR_OUT2, COM1 + REG_MCR);
+    outb(IER_RX, COM1 + REG_IER);
+
+    serial_ready = 1;
+    tx_start();
+    enable_irq(SERIAL_IRQ);
+    restore_flags(flags);
+}
+
+/*
+ * serial_handler
+ *   DESCRIPTION: Serves every pending cause of the COM1 interrupt, an
+ *                empty transmitter gets the next FIFO load and received
+ *                bytes wake the readers
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void serial_handler(void) {
+    uint8_t iir;
+
+    while(!((iir = inb(COM1 + REG_IIR)) & IIR_NO_INT)) {
+        switch(iir & IIR_ID) {
+        case IIR_TX:
+            tx_busy = 0;
+            tx_start();
+            break;
+        case IIR_RX:
+        case IIR_TIMEOUT:
+            rx_drain();
+            break;
+        case IIR_LINE:
+            inb(COM1 + REG_LSR);
+            break;
+        default:
+            inb(COM1 + REG_MSR);
+            break;
+        }
+    }
+
+    send_eoi(SERIAL_IRQ);
+}
+
+/*
+ * serial_putc
+ *   DESCRIPTION: Queues one byte of kernel output, a line feed goes out
+ *                as CR LF. The byte is dropped if the ring is full so the
+ *                caller never waits on the UART
+ *   INPUTS: c--byte to send
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void serial_putc(uint8_t c) {
+    uint32_t flags;
+
+    cli_and_save(flags);
+    if(c == '\n' && tx_head - tx_tail < TX_SIZE) tx_buf[tx_head++ & (TX_SIZE - 1)] = '\r';
+    if(tx_head - tx_tail < TX_SIZE) tx_buf[tx_head++ & (TX_SIZE - 1)] = c;
+    tx_start();
+    restore_flags(flags);
+}
+
+/*
+ * serial_open
+ *   DESCRIPTION: Opens the serial port, it is set up at boot
+ *   INPUTS: filename--not used
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: none
+ */
+int32_t serial_open(const uint8_t* filename) {
+    return 0;
+}
+
+/*
+ * serial_close
+ *   DESCRIPTION: Closes the serial port--does nothing
+ *   INPUTS: fd--not used
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: none
+ */
+int32_t serial_close(int32_t fd) {
+    return 0;
+}
+
+/*
+ * serial_read
+ *   DESCRIPTION: Copies received bytes into buf, sleeps until at least
+ *                one has arrived
+ *   INPUTS: fd--not used
+ *           buf--buffer to fill
+ *           nbytes--size of buf
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes read
+ *   SIDE EFFECTS: none
+ */
+int32_t serial_read(int32_t fd, void* buf, int32_t nbytes) {
+    int32_t i;
+
+    if(nbytes <= 0) return 0;
+
+    cli();
+    while(rx_head == rx_tail) sleep_on(&rx_wait);
+    for(i = 0; i < nbytes && rx_tail != rx_head; i++) {
+        ((uint8_t*)buf)[i] = rx_buf[rx_tail++ & (RX_SIZE - 1)];
+    }
+    sti();
+
+    return i;
+}
+
+/*
+ * serial_write
+ *   DESCRIPTION: Queues as much of buf for transmission as fits in the
+ *                ring, the caller writes the rest again
+ *   INPUTS: fd--not used
+ *           buf--bytes to send
+ *           nbytes--number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes queued
+ *   SIDE EFFECTS: none
+ */
+int32_t serial_write(int32_t fd, const void* buf, int32_t nbytes) {
+    uint32_t flags;
+    int32_t i;
+
+    cli_and_save(flags);
+    for(i = 0; i < nbytes && tx_head - tx_tail < TX_SIZE; i++) {
+        tx_buf[tx_head++ & (TX_SIZE - 1)] = ((const uint8_t*)buf)[i];
+    }
+    tx_start();
+    restore_flags(flags);
+
+    return i;
+}
+
+/*
+ * tx_start
+ *   DESCRIPTION: Fills the empty transmit FIFO from the ring and asks for
+ *                an interrupt once it drains, or turns that interrupt off
+ *                when there is nothing left. Called with interrupts off
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void tx_start(void) {
+    int n;
+
+    if(!serial_ready || tx_busy) return;
+
+    for(n = 0; n < FIFO_SIZE && tx_tail != tx_head; n++) {
+        outb(tx_buf[tx_tail++ & (TX_SIZE - 1)], COM1 + REG_DATA);
+    }
+    tx_busy = (n > 0);
+    outb(tx_busy ? (IER_RX | IER_TX) : IER_RX, COM1 + REG_IER);
+}
+
+/*
+ * rx_drain
+ *   DESCRIPTION: Moves every byte in the receive FIFO into the ring and
+ *                wakes the readers, bytes that do not fit are lost
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void rx_drain(void) {
+    uint8_t c;
+
+    while(inb(COM1 + REG_LSR) & LSR_DATA) {
+        c = inb(COM1 + REG_DATA);
+        if(rx_head - rx_tail < RX_SIZE) rx_buf[rx_head++ & (RX_SIZE - 1)] = c;
+    }
+    wake_up(&rx_wait);
+}
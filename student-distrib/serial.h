@@ -0,0 +1,31 @@
+/* serial.h - interrupt driven 16550 UART on COM1
+ */
+
+#ifndef _SERIAL_H
+#define _SERIAL_H
+
+#include "types.h"
+
+#define SERIAL_NAME             "ttyS0"     // name open() takes for the port
+
+#ifndef ASM
+
+/* Set up COM1 and enable its interrupt */
+void serial_init(void);
+/* Interrupt handler of COM1 */
+void serial_handler(void);
+/* Queue one byte of kernel output, never waits for the UART */
+void serial_putc(uint8_t c);
+
+/* Open the serial port */
+int32_t serial_open(const uint8_t* filename);
+/* Close the serial port */
+int32_t serial_close(int32_t fd);
+/* Read received bytes, blocks until there is at least one */
+int32_t serial_read(int32_t fd, void* buf, int32_t nbytes);
+/* Queue bytes for transmission, returns how many fit */
+int32_t serial_write(int32_t fd, const void* buf, int32_t nbytes);
+
+#endif
+
+#endif
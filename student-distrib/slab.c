@@ -0,0 +1,364 @@
+/* slab.c - kernel object allocator (kmalloc/kfree) built from slab caches
+ *
+ * Objects live in 4 kB slabs carved from a static arena inside the 4-8 MB
+ * kernel page. Each slab starts with a header naming its cache, so kfree
+ * finds the cache from the page the pointer falls in. The header is
+ * followed by one bufctl per object, the free list is threaded through
+ * those indices so a free object keeps every byte its constructor set.
+ */
+
+#include "slab.h"
+#include "lib.h"
+#include "klog.h"
+
+// Magic Numbers
+#define ARENA_SIZE          0x100000            // 1 MB of the kernel page
+#define SLAB_SIZE           0x1000
+#define ARENA_PAGES         (ARENA_SIZE / SLAB_SIZE)
+#define MAX_CACHES          16
+#define KMALLOC_CLASSES     8                   // 16, 32, ... 2048 bytes
+#define KMALLOC_MIN_SHIFT   4
+#define OBJ_ALIGN           8
+#define PERCENT             100
+#define BUFCTL_END          0xFFFF              // ends a slab's free list
+
+// index of the next free object, one per object after the slab header
+typedef uint16_t bufctl_t;
+
+// header at the start of every slab
+struct slab_t {
+    kmem_cache_t* cache;
+    struct slab_t* next;
+    struct slab_t* prev;
+    uint32_t free;                              // first free object, BUFCTL_END if none
+    uint32_t inuse;
+};
+
+#define SLAB_BUFCTL(slab)   ((bufctl_t*)((slab_t*)(slab) + 1))
+#define ALIGN_UP(x)         (((x) + OBJ_ALIGN - 1) & ~(OBJ_ALIGN - 1))
+
+static uint8_t arena[ARENA_SIZE] __attribute__((aligned(SLAB_SIZE)));
+// free arena pages, linked through their first word
+static void* free_pages;
+static uint32_t pages_free;
+static kmem_cache_t caches[MAX_CACHES];
+static uint32_t num_caches;
+static kmem_cache_t* size_class[KMALLOC_CLASSES];
+
+// Local functions
+static slab_t* slab_grow(kmem_cache_t* cache);
+static void slab_unlink(slab_t** list, slab_t* slab);
+static void slab_push(slab_t** list, slab_t* slab);
+static void page_free(void* page);
+
+/*
+ * slab_init
+ *   DESCRIPTION: Puts every arena page on the free page list and creates
+ *                the caches backing kmalloc
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void slab_init(void) {
+    uint32_t i;
+    char name[CACHE_NAME_LEN] = "kmalloc-";
+
+    free_pages = NULL;
+    pages_free = 0;
+    for (i = ARENA_PAGES; i > 0; i--) {
+        page_free(&arena[(i - 1) * SLAB_SIZE]);
+    }
+
+    memset(caches, 0, sizeof(caches));
+    num_caches = 0;
+    for (i = 0; i < KMALLOC_CLASSES; i++) {
+        itoa(1 << (i + KMALLOC_MIN_SHIFT), (int8_t*)&name[8], 10);
+        size_class[i] = kmem_cache_create(name, 1 << (i + KMALLOC_MIN_SHIFT), NULL);
+    }
+}
+
+/*
+ * kmem_cache_create
+ *   DESCRIPTION: Creates a cache of objects of one size. The constructor
+ *                runs on each object once, when the slab holding it is
+ *                made, and freed objects must be handed back in their
+ *                constructed state so the next allocation can skip it
+ *   INPUTS: name--name shown by kmem_dump
+ *           size--object size in bytes, at most KMALLOC_MAX
+ *           ctor--constructor, may be NULL
+ *   OUTPUTS: none
+ *   RETURN VALUE: the cache, NULL if the size is too large or there are
+ *                 no cache descriptors left
+ *   SIDE EFFECTS: none
+ */
+kmem_cache_t* kmem_cache_create(const char* name, uint32_t size, ctor_t ctor) {
+    kmem_cache_t* cache;
+
+    if (size == 0 || size > KMALLOC_MAX || num_caches == MAX_CACHES) return NULL;
+
+    cache = &caches[num_caches++];
+    strncpy((int8_t*)cache->name, (int8_t*)name, CACHE_NAME_LEN - 1);
+    cache->name[CACHE_NAME_LEN - 1] = '\0';
+    // aligned for any kernel structure
+    cache->obj_size = ALIGN_UP(size);
+    // every object costs its size and a bufctl, the objects start aligned
+    cache->per_slab = (SLAB_SIZE - sizeof(slab_t)) / (cache->obj_size + sizeof(bufctl_t));
+    while (ALIGN_UP(sizeof(slab_t) + cache->per_slab * sizeof(bufctl_t)) +
+           cache->per_slab * cache->obj_size > SLAB_SIZE) {
+        cache->per_slab--;
+    }
+    cache->obj_offset = ALIGN_UP(sizeof(slab_t) + cache->per_slab * sizeof(bufctl_t));
+    cache->ctor = ctor;
+    return cache;
+}
+
+/*
+ * kmem_cache_alloc
+ *   DESCRIPTION: Takes an object from a partially used slab, then from an
+ *                empty one, growing the cache by a slab if neither exists
+ *   INPUTS: cache--cache to allocate from
+ *   OUTPUTS: none
+ *   RETURN VALUE: the object, NULL if the arena is exhausted
+ *   SIDE EFFECTS: none
+ */
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    uint32_t flags;
+    slab_t* slab;
+    void* obj;
+
+    if (cache == NULL) return NULL;
+
+    cli_and_save(flags);
+    slab = cache->partial;
+    if (slab == NULL) {
+        slab = cache->empty;
+        if (slab != NULL) slab_unlink(&cache->empty, slab);
+        else slab = slab_grow(cache);
+        if (slab == NULL) {
+            cache->failures++;
+            restore_flags(flags);
+            return NULL;
+        }
+        slab_push(&cache->partial, slab);
+    }
+
+    obj = (uint8_t*)slab + cache->obj_offset + slab->free * cache->obj_size;
+    slab->free = SLAB_BUFCTL(slab)[slab->free];
+    slab->inuse++;
+    if (slab->inuse == cache->per_slab) {
+        slab_unlink(&cache->partial, slab);
+        slab_push(&cache->full, slab);
+    }
+    cache->allocs++;
+    cache->active++;
+    restore_flags(flags);
+
+    return obj;
+}
+
+/*
+ * kmem_cache_free
+ *   DESCRIPTION: Returns an object to its slab. A cache keeps one empty
+ *                slab for the next allocation, further empty slabs go
+ *                back to the arena
+ *   INPUTS: cache--cache the object came from
+ *           obj--the object, ignored if NULL
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void kmem_cache_free(kmem_cache_t* cache, void* obj) {
+    uint32_t flags, offset, idx;
+    slab_t* slab;
+
+    if (cache == NULL || obj == NULL) return;
+    slab = (slab_t*)((uint32_t)obj & ~(SLAB_SIZE - 1));
+    if (slab->cache != cache) return;
+    offset = (uint32_t)obj - (uint32_t)slab;
+    if (offset < cache->obj_offset || (offset - cache->obj_offset) % cache->obj_size != 0) return;
+    idx = (offset - cache->obj_offset) / cache->obj_size;
+
+    cli_and_save(flags);
+    if (slab->inuse == cache->per_slab) {
+        slab_unlink(&cache->full, slab);
+        slab_push(&cache->partial, slab);
+    }
+    SLAB_BUFCTL(slab)[idx] = slab->free;
+    slab->free = idx;
+    slab->inuse--;
+    if (slab->inuse == 0) {
+        slab_unlink(&cache->partial, slab);
+        if (cache->empty == NULL) {
+            slab_push(&cache->empty, slab);
+        } else {
+            cache->slabs--;
+            page_free(slab);
+        }
+    }
+    cache->frees++;
+    cache->active--;
+    restore_flags(flags);
+}
+
+/*
+ * kmalloc
+ *   DESCRIPTION: Allocates from the smallest size class that fits
+ *   INPUTS: size--bytes needed, at most KMALLOC_MAX
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the memory (8 byte aligned, not cleared),
+ *                 NULL on failure
+ *   SIDE EFFECTS: none
+ */
+void* kmalloc(uint32_t size) {
+    uint32_t i;
+
+    if (size == 0 || size > KMALLOC_MAX) return NULL;
+    for (i = 0; (1U << (i + KMALLOC_MIN_SHIFT)) < size; i++);
+    return kmem_cache_alloc(size_class[i]);
+}
+
+/*
+ * kfree
+ *   DESCRIPTION: Frees memory from kmalloc or any cache, the cache is
+ *                read from the slab header
+ *   INPUTS: ptr--memory to free, ignored if NULL or outside the arena
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void kfree(void* ptr) {
+    if ((uint8_t*)ptr < arena || (uint8_t*)ptr >= arena + ARENA_SIZE) return;
+    kmem_cache_free(((slab_t*)((uint32_t)ptr & ~(SLAB_SIZE - 1)))->cache, ptr);
+}
+
+/*
+ * kmem_cache_stats
+ *   DESCRIPTION: Copies the counters of a cache. Fragmentation is the
+ *                share of the cache's pages not covered by live objects,
+ *                slab headers and per-slab leftovers included
+ *   INPUTS: cache--cache to inspect
+ *   OUTPUTS: stats--filled in
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void kmem_cache_stats(kmem_cache_t* cache, kmem_stats_t* stats) {
+    uint32_t flags;
+
+    if (cache == NULL || stats == NULL) return;
+
+    cli_and_save(flags);
+    stats->allocs = cache->allocs;
+    stats->frees = cache->frees;
+    stats->failures = cache->failures;
+    stats->active = cache->active;
+    stats->slabs = cache->slabs;
+    stats->capacity = cache->slabs * cache->per_slab;
+    if (cache->slabs == 0) stats->frag_pct = 0;
+    else stats->frag_pct = PERCENT - cache->active * cache->obj_size * PERCENT / (cache->slabs * SLAB_SIZE);
+    restore_flags(flags);
+}
+
+/*
+ * kmem_dump
+ *   DESCRIPTION: Logs one line of counters for every cache and the
+ *                number of free arena pages, dmesg shows the table
+ *   INPUTS: none
+ *   OUTPUTS: the table in the kernel log
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void kmem_dump(void) {
+    uint32_t i;
+    kmem_stats_t st;
+
+    klog("cache            size  active/cap   slabs  allocs  frees  fail  frag\n");
+    for (i = 0; i < num_caches; i++) {
+        kmem_cache_stats(&caches[i], &st);
+        klog("%s  %d  %d/%d  %d  %d  %d  %d  %d%%\n", caches[i].name, caches[i].obj_size,
+               st.active, st.capacity, st.slabs, st.allocs, st.frees, st.failures, st.frag_pct);
+    }
+    klog("free pages: %d of %d\n", pages_free, ARENA_PAGES);
+}
+
+/*
+ * slab_grow
+ *   DESCRIPTION: Makes a new slab for a cache from a free arena page:
+ *                writes the header, chains the bufctls into the free list
+ *                and runs the constructor on each object
+ *   INPUTS: cache--cache to grow
+ *   OUTPUTS: none
+ *   RETURN VALUE: the slab, NULL if the arena has no free page
+ *   SIDE EFFECTS: none
+ */
+static slab_t* slab_grow(kmem_cache_t* cache) {
+    slab_t* slab;
+    uint8_t* obj;
+    uint32_t i;
+
+    if (free_pages == NULL) return NULL;
+    slab = (slab_t*)free_pages;
+    free_pages = *(void**)free_pages;
+    pages_free--;
+
+    slab->cache = cache;
+    slab->next = NULL;
+    slab->prev = NULL;
+    slab->inuse = 0;
+    // objects are handed out in address order
+    slab->free = 0;
+    obj = (uint8_t*)slab + cache->obj_offset;
+    for (i = 0; i < cache->per_slab; i++, obj += cache->obj_size) {
+        if (cache->ctor != NULL) cache->ctor(obj);
+        SLAB_BUFCTL(slab)[i] = (i + 1 < cache->per_slab) ? i + 1 : BUFCTL_END;
+    }
+    cache->slabs++;
+    return slab;
+}
+
+/*
+ * slab_unlink
+ *   DESCRIPTION: Takes a slab off one of its cache's lists
+ *   INPUTS: list--head of the list
+ *           slab--slab to remove
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void slab_unlink(slab_t** list, slab_t* slab) {
+    if (slab->prev != NULL) slab->prev->next = slab->next;
+    else *list = slab->next;
+    if (slab->next != NULL) slab->next->prev = slab->prev;
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+/*
+ * slab_push
+ *   DESCRIPTION: Puts a slab at the head of one of its cache's lists
+ *   INPUTS: list--head of the list
+ *           slab--slab to add
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void slab_push(slab_t** list, slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list != NULL) (*list)->prev = slab;
+    *list = slab;
+}
+
+/*
+ * page_free
+ *   DESCRIPTION: Returns a page to the arena
+ *   INPUTS: page--4 kB aligned page inside the arena
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void page_free(void* page) {
+    *(void**)page = free_pages;
+    free_pages = page;
+    pages_free++;
+}
@@ -0,0 +1,62 @@
+/* slab.h - kernel object allocator (kmalloc/kfree) built from slab caches
+ */
+
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include "types.h"
+
+#define KMALLOC_MAX         2048                // largest kmalloc size class
+#define CACHE_NAME_LEN      16
+
+typedef void (*ctor_t)(void* obj);
+
+typedef struct slab_t slab_t;
+
+// a cache of equally sized objects
+typedef struct kmem_cache_t {
+    char name[CACHE_NAME_LEN];
+    uint32_t obj_size;
+    uint32_t per_slab;                          // objects in one slab
+    uint32_t obj_offset;                        // first object, after the header and bufctls
+    ctor_t ctor;
+    slab_t* partial;                            // slabs with free and used objects
+    slab_t* full;
+    slab_t* empty;
+    // statistics
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failures;
+    uint32_t active;                            // objects handed out
+    uint32_t slabs;
+} kmem_cache_t;
+
+// snapshot of a cache's counters
+typedef struct kmem_stats_t {
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failures;
+    uint32_t active;
+    uint32_t capacity;                          // objects the cache's slabs can hold
+    uint32_t slabs;
+    uint32_t frag_pct;                          // unused share of the cache's pages
+} kmem_stats_t;
+
+/* Set up the arena and the kmalloc size classes */
+void slab_init(void);
+/* Create a cache of objects of one size, ctor runs once per object when its slab is made */
+kmem_cache_t* kmem_cache_create(const char* name, uint32_t size, ctor_t ctor);
+/* Take an object from a cache */
+void* kmem_cache_alloc(kmem_cache_t* cache);
+/* Give an object back to its cache, in its constructed state */
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+/* Allocate size bytes */
+void* kmalloc(uint32_t size);
+/* Free memory from kmalloc */
+void kfree(void* ptr);
+/* Read the counters of a cache */
+void kmem_cache_stats(kmem_cache_t* cache, kmem_stats_t* stats);
+/* Log the counters of every cache */
+void kmem_dump(void);
+
+#endif
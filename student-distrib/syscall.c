@@ -7,6 +7,13 @@
 #include "x86_desc.h"
 #include "lib.h"
 #include "terminal.h"
+#include "image_cache.h"
+#include "buddy.h"
+#include "scheduler.h"
+#include "serial.h"
+#include "klog.h"
+#include "clock.h"
+#include "timer.h"
 
 // File Operations Definitions
 fops_t stdin_func = {(read_t)terminal_read, NULL, NULL, NULL};
@@ -14,11 +21,22 @@ fops_t stdout_func = {NULL, (write_t)terminal_write, NULL, NULL};
 fops_t rtc_func = {(read_t)rtc_read, (write_t)rtc_write, (open_t)rtc_open, (close_t)rtc_close};
 fops_t file_func = {(read_t)file_read, (write_t)file_write, (open_t)file_open, (close_t)file_close};
 fops_t dir_func = {(read_t)dir_read, (write_t)dir_write, (open_t)dir_open, (close_t)dir_close};
+fops_t serial_func = {(read_t)serial_read, (write_t)serial_write, (open_t)serial_open, (close_t)serial_close};
+fops_t dmesg_func = {(read_t)dmesg_read, (write_t)dmesg_write, (open_t)dmesg_open, (close_t)dmesg_close};
+
+// Devices open() knows by name, they are not in the filesystem
+static const struct {
+    const int8_t* name;
+    uint32_t len;
+    fops_t* fops;
+} devices[] = {
+    {(const int8_t*)SERIAL_NAME, sizeof(SERIAL_NAME), &serial_func},
+    {(const int8_t*)KLOG_NAME, sizeof(KLOG_NAME), &dmesg_func},
+};
+#define NUM_DEVICES (sizeof(devices) / sizeof(devices[0]))
 
 // Magic Numbers
 #define USER_ESP 		0x083FFFFC			// 128 MB + 4 MB - 4
-#define USER_MEM_START	0x0800000			// 8 MB
-#define KERNEL_MEM_END	0x0800000			// 8 MB
 #define PAGE_SIZE 		0x400000			// 4 MB
 #define KRNL_STACK_SIZE 0x2000				// 8 KB
 #define MAGIC0			0x7F
@@ -26,26 +44,51 @@ fops_t dir_func = {(read_t)dir_read, (write_t)dir_write, (open_t)dir_open, (clos
 #define MAGIC2 			0x4C
 #define MAGIC3 			0x46
 #define VIRTUAL_ADDR	0x08048000
-#define ATTR			0x87
-#define SHIFT_4MB 		22
 #define IF_FLAG 		0x200
 #define FILENAME_MAX 	32
 #define MASK 			0xFF
-#define MAX_PCB 		6
+#define MAX_PID			1024
+#define PID_WORDS		(MAX_PID / 32)
+#define STACK_ORDER		1					// 8 KB block from the frame allocator
+#define STACK_CACHE_MAX	16					// freed stacks kept for reuse
 #define NUM_FILES	 	8
 #define RTC_TYPE		0
 #define DIR_TYPE		1
 #define FILE_TYPE 		2
 #define USER_BEGIN		0x8000000
 #define	USER_VID		0xFFC00000
+#define IO_RING_ADDR	USER_BEGIN			// below the program image
+#define ENTRY_OFFSET	24
+#define NS_PER_SEC		1000000000
+#define NS_PER_TICK		(NS_PER_SEC / PIT_HZ)
+#define MAX_SLEEP_SEC	((1 << 24) / PIT_HZ)	// the timer wheel's reach
+#define PF_USER			0x4					// page fault error code: raised in user mode
+#define FAULT_STATUS	0xFF				// halt status of a process killed by a fault
 // #define PAGE_4KB        0x1000
 
-void syscall_init() {
-	int i;
+// PCB pool: every process gets an 8 KB block holding its PCB at the bottom
+// and its kernel stack above it
+static pcb_t* pcb_table[MAX_PID];
+// one bit per pid, set while the pid is in use
+static uint32_t pid_map[PID_WORDS];
+// first word of pid_map that may still have a clear bit
+static uint32_t pid_hint;
+// freed blocks, linked through their first word
+static uint32_t* stack_cache;
+static uint32_t stack_cached;
+
+// Local functions
+static int32_t pcb_alloc(void);
+static void pcb_free(uint32_t pid);
+static void sleep_timeout(uint32_t data);
 
-	for(i = 0; i < 6; i++) {
-		pcb_status[i] = 0;
-	}
+void syscall_init() {
+	memset(pcb_table, 0, sizeof(pcb_table));
+	memset(pid_map, 0, sizeof(pid_map));
+	pid_hint = 0;
+	stack_cache = NULL;
+	stack_cached = 0;
+	image_cache_init();
 }
 
 /*
@@ -68,7 +111,20 @@ int32_t halt(uint8_t status) {
     esp = current->esp;
     ebp = current->ebp;
 
+    //the child's kernel stack is freed below while still in use, nothing
+    //else may run until we are off it
+    cli();
+
+    //leave the child's address space before its frames are freed
+    if(parent==-1) load_kernel_pg_drct();
+    else load_pg_drct(get_pcb(parent)->pg_drct);
+
+    //the parent runs again in the child's place
+    if(parent==-1) sched_remove(current);
+    else sched_replace(current, get_pcb(parent));
+
     //destroy child PCB
+    terminal_unpin_origin(processing_terminal, current->pid);
     end_process(current->pid);
 
     terminal[processing_terminal].cur_pid = parent;
@@ -78,11 +134,8 @@ int32_t halt(uint8_t status) {
 
     pcb_t* parent_pcb = get_pcb(parent);
 
-    //restore parents paging and flush TLB
-    set_pde(VIRTUAL_ADDR >> SHIFT_4MB, parent_pcb->pd_entry);
-
     //restore parents data
-    tss.esp0=parent_pcb->esp0;
+    set_kernel_stack(parent_pcb->esp0);
     tss.ss0=parent_pcb->ss0;
 
     //jump to label halt_ret
@@ -163,22 +216,32 @@ int32_t execute(const uint8_t* command) {
 		// Not executable file, fail
 		return -1;
 	}
-
-	// Create PCB
-	uint32_t pid = -1;
-	for (i = 0; i < MAX_PCB; i++) {
-		if (pcb_status[i] == 0) {
-			pid = i;
-			break;
-		}
+	// Entry point is 24, 25, 26, 27th bytes of the file, with bit shift 0 8 16 24,
+	// read before anything is set up so a truncated file has nothing to undo
+	if(read_data(dentry.inode, ENTRY_OFFSET, buf, 4) != 4) return -1;
+	uint32_t entry_point = buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
+
+	// The rest runs with interrupts off, the run queue and TSS must not be
+	// switched under us before the iret
+	uint32_t flags;
+	cli_and_save(flags);
+	// Address space: only the Page Directory and Page Table are allocated now
+	uint32_t pg_drct = user_space_init();
+	if (pg_drct == 0) {
+		restore_flags(flags);
+		return -1;
 	}
+	// Create PCB
+	int32_t pid = pcb_alloc();
 	//return -1 upon failure of allocating space for pcb
-	if (pid == -1) return -1;
-	//indicate that this pid has existed
-	pcb_status[pid] = 1;
-	//specify address for new pid
-	pcb_t *cur_pcb = (pcb_t *) (KERNEL_MEM_END - KRNL_STACK_SIZE * (pid + 1));
+	if (pid == -1) {
+		user_space_free(pg_drct);
+		restore_flags(flags);
+		return -1;
+	}
+	pcb_t *cur_pcb = get_pcb(pid);
 	cur_pcb->pid = pid;
+	cur_pcb->term = processing_terminal;
 	terminal[processing_terminal].num_process++;
 	//save parent pid number
 	if(terminal[processing_terminal].num_process == 1) cur_pcb->parent = -1;
@@ -192,20 +255,16 @@ int32_t execute(const uint8_t* command) {
     }
     cur_pcb -> arg[i] = '\0';
 	// Set up TSS
-	tss.esp0 = KERNEL_MEM_END - pid*KRNL_STACK_SIZE - 4;
+	set_kernel_stack((uint32_t)cur_pcb + KRNL_STACK_SIZE - 4);
 	tss.ss0 = KERNEL_DS;
 	//store the parent's esp0 and ss0
 	cur_pcb->esp0 = tss.esp0;
 	cur_pcb->ss0 = tss.ss0;
 	strcpy(args, cur_pcb->arg);
 
-	// Loader: set up paging
-	uint32_t virt_addr = VIRTUAL_ADDR;
-	uint32_t phys_addr = pid*PAGE_SIZE + USER_MEM_START;
-	set_pde(virt_addr >> SHIFT_4MB, phys_addr | ATTR);
-
-	// Continue PCB
-	cur_pcb->pd_entry = phys_addr | ATTR;
+	// Loader: set up paging, every user page starts out not present
+	cur_pcb->pg_drct = pg_drct;
+	load_pg_drct(cur_pcb->pg_drct);
 
 	//initialization for stdin
 	cur_pcb->f_array[0].fops = stdin_func;
@@ -228,15 +287,16 @@ int32_t execute(const uint8_t* command) {
 		cur_pcb->f_array[i].flags = 0;
 	}
 
-	// Copy into memory
+	// The image is not copied here, load_user_page brings it in a page at a time
 	inode_t* inodefind = inode_find(dentry);
-	read_data(dentry.inode, 0, (uint8_t*)virt_addr, inodefind->length);
-    
-    uint8_t *tmp = (uint8_t *)virt_addr;
-	// Entry point is 24, 25, 26, 27th bytes of the file, with bit shift 0 8 16 24
-	uint32_t entry_point = tmp[24] | (tmp[25] << 8) | (tmp[26] << 16) | (tmp[27] << 24);
-	// Equivalent: uint32_t entry_point = ((uint32_t*)tmp)[6];
-	// Equivalent: uint32_t entry_point = *(((uint32_t *)tmp) + 6);
+	cur_pcb->exe_inode = dentry.inode;
+	cur_pcb->exe_length = inodefind->length;
+	cur_pcb->image = image_cache_get(dentry.inode);
+	memset(&cur_pcb->sleep_timer, 0, sizeof(timer_t));
+	cur_pcb->io_ring = NULL;
+
+	// The new process takes the place of its parent in the run queue
+	sched_replace(cur_pcb->parent == -1 ? NULL : get_pcb(cur_pcb->parent), cur_pcb);
 
 	// Push IRET context to stack
 	// uint32_t eflags_reg;
@@ -245,6 +305,7 @@ int32_t execute(const uint8_t* command) {
 	asm volatile("pushl %0":: "g"(USER_DS));			// SS
 	asm volatile("pushl %0":: "g"(USER_ESP));			// ESP
 	asm volatile("pushfl");								// EFLAGS
+	asm volatile("orl %0, (%%esp)":: "i"(IF_FLAG));		// user code runs with interrupts on
 	asm volatile("pushl %0":: "g"(USER_CS));			// CS
 	asm volatile("pushl %0":: "g"(entry_point));		// EIP
 
@@ -316,12 +377,9 @@ int32_t write(int32_t fd, const void* buf, int32_t nbytes) {
 int32_t open(const uint8_t* filename) {
     dentry_t fileopen;
     int i = 0;
+    uint32_t j;
     //get current pcb
 	pcb_t* curr_pcb = get_pcb(terminal[processing_terminal].cur_pid);
-    //fail condition
-    if (read_dentry_by_name(filename, &fileopen) == -1){
-        return -1;
-    }
     // find the next available entry in fd
     for (i = 0; i < NUM_FILES; i++)
     {
@@ -331,6 +389,22 @@ int32_t open(const uint8_t* filename) {
     }
     //all full
     if(i == NUM_FILES) return -1;
+    // devices are not files of the filesystem
+    for (j = 0; filename != NULL && j < NUM_DEVICES; j++)
+    {
+        if (strncmp((const int8_t*)filename, devices[j].name, devices[j].len) == 0) {
+            curr_pcb->f_array[i].flags = 1;
+            curr_pcb->f_array[i].fpos = 0;
+            curr_pcb->f_array[i].inode = 0;
+            curr_pcb -> f_array[i].fops = *devices[j].fops;
+            curr_pcb -> f_array[i].fops.open_func(filename);
+            return i;
+        }
+    }
+    //fail condition
+    if (read_dentry_by_name(filename, &fileopen) == -1){
+        return -1;
+    }
     // wrong type
     if (fileopen.file_type < 0 || fileopen.file_type > 2) {
         return -1;
@@ -418,11 +492,14 @@ int32_t getargs(uint8_t* buf, int32_t nbytes) {
  *   INPUTS: none
  *   OUTPUTS: screen_start--where the screens starts
  *   RETURN VALUE: 0 on success, always succeeds
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: keeps the terminal from scrolling through its ring until
+ *                 the process halts
  */
 
 int32_t vidmap(uint8_t** screen_start) {
     if(screen_start < (uint8_t **)USER_BEGIN || screen_start >= (uint8_t **)(USER_BEGIN + PAGE_SIZE)) return -1;
+    // the mapping points at the top of the ring, scrolling must not move it
+    terminal_pin_origin(processing_terminal, terminal[processing_terminal].cur_pid);
     *screen_start = (uint8_t *)(USER_VID + processing_terminal*PAGE_4KB);
     return 0;
 }
@@ -451,6 +528,140 @@ int32_t sigreturn(void){
 	return -1;
 }
 
+/*
+ * gettime
+ *   DESCRIPTION: reads the monotonic clock
+ *   INPUTS: none
+ *   OUTPUTS: ts--seconds and nanoseconds since boot
+ *   RETURN VALUE: 0 on success, -1 if ts is not in the user page
+ *   SIDE EFFECTS: none
+ */
+int32_t gettime(timespec_t* ts) {
+    // compared without adding to ts, which could wrap past 4 GB
+    if((uint32_t)ts < USER_BEGIN || (uint32_t)ts > USER_BEGIN + PAGE_SIZE - sizeof(timespec_t)) return -1;
+    ns_to_timespec(clock_ns(), ts);
+    return 0;
+}
+
+/*
+ * nanosleep
+ *   DESCRIPTION: Blocks the calling process for at least the given time.
+ *                The sleep timer in its PCB is queued in the timer wheel
+ *                for the tick after the deadline, the partial tick that
+ *                is running now does not count
+ *   INPUTS: sec--seconds to sleep
+ *           nsec--nanoseconds on top of sec, below one second
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if nsec is out of range
+ *   SIDE EFFECTS: none
+ */
+int32_t nanosleep(uint32_t sec, uint32_t nsec) {
+    pcb_t* cur_pcb = cur_task;
+    wait_queue_t wq = {NULL, NULL};
+    uint32_t ticks;
+
+    if(nsec >= NS_PER_SEC) return -1;
+    if(sec >= MAX_SLEEP_SEC) sec = MAX_SLEEP_SEC;
+    ticks = sec * PIT_HZ + (nsec + NS_PER_TICK - 1) / NS_PER_TICK;
+    if(ticks == 0) return 0;
+
+    cli();
+    cur_pcb->sleep_timer.fn = sleep_timeout;
+    cur_pcb->sleep_timer.data = (uint32_t)&wq;
+    timer_add(&cur_pcb->sleep_timer, jiffies + ticks + 1);
+    while(timer_pending(&cur_pcb->sleep_timer)) sleep_on(&wq);
+    sti();
+
+    return 0;
+}
+
+/*
+ * io_setup
+ *   DESCRIPTION: Gives the process a page holding a submission and a
+ *                completion ring, mapped writable at IO_RING_ADDR. The
+ *                page is private to the process and freed with its other
+ *                user pages
+ *   INPUTS: none
+ *   OUTPUTS: ring--where the ring page starts
+ *   RETURN VALUE: 0 on success, -1 on a bad pointer or if memory ran out
+ *   SIDE EFFECTS: none
+ */
+int32_t io_setup(void** ring) {
+    pcb_t* cur_pcb = get_pcb(terminal[processing_terminal].cur_pid);
+    uint32_t frame;
+
+    if((uint32_t)ring < USER_BEGIN || (uint32_t)ring > USER_BEGIN + PAGE_SIZE - sizeof(void*)) return -1;
+    if(cur_pcb->io_ring == NULL) {
+        // the page is below the image, nothing but the ring uses it
+        if(user_page_present(IO_RING_ADDR)) return -1;
+        frame = frame_alloc(0);
+        if(frame == 0) return -1;
+        memset((void*)frame, 0, PAGE_4KB);
+        map_user_frame(IO_RING_ADDR, frame, 1);
+        cur_pcb->io_ring = (io_ring_t*)frame;
+    }
+    *ring = (void*)IO_RING_ADDR;
+    return 0;
+}
+
+/*
+ * io_enter
+ *   DESCRIPTION: Runs queued submissions in order through the fops of
+ *                their files, as read and write would, and posts a
+ *                completion for each. Every entry is copied out of the
+ *                shared page before it is checked. Stops early when the
+ *                completion ring is full
+ *   INPUTS: to_submit--most submissions to run
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of submissions consumed, -1 without io_setup
+ *   SIDE EFFECTS: none
+ */
+int32_t io_enter(uint32_t to_submit) {
+    pcb_t* cur_pcb = get_pcb(terminal[processing_terminal].cur_pid);
+    io_ring_t* ring = cur_pcb->io_ring;
+    io_sqe_t sqe;
+    uint32_t head, tail, done;
+    int32_t res;
+
+    if(ring == NULL) return -1;
+
+    head = ring->sq_head;
+    tail = ring->sq_tail;
+    if(tail - head > IO_SQ_ENTRIES) return -1;
+    for(done = 0; done < to_submit && head != tail; done++, head++) {
+        if(ring->cq_tail - ring->cq_head >= IO_CQ_ENTRIES) break;
+        sqe = ring->sqes[head % IO_SQ_ENTRIES];
+
+        // the buffer must lie in the user page, compared without adding
+        // to buf, which could wrap past 4 GB
+        res = -1;
+        if(sqe.nbytes >= 0 && sqe.buf >= USER_BEGIN && sqe.buf <= USER_BEGIN + PAGE_SIZE &&
+           (uint32_t)sqe.nbytes <= USER_BEGIN + PAGE_SIZE - sqe.buf) {
+            if(sqe.op == IO_OP_READ) res = read(sqe.fd, (void*)sqe.buf, sqe.nbytes);
+            else if(sqe.op == IO_OP_WRITE) res = write(sqe.fd, (const void*)sqe.buf, sqe.nbytes);
+        }
+
+        ring->cqes[ring->cq_tail % IO_CQ_ENTRIES].user_data = sqe.user_data;
+        ring->cqes[ring->cq_tail % IO_CQ_ENTRIES].res = res;
+        ring->cq_tail++;
+        ring->sq_head = head + 1;
+    }
+
+    return done;
+}
+
+/*
+ * sleep_timeout
+ *   DESCRIPTION: Sleep timer callback, wakes the sleeping process
+ *   INPUTS: data--wait queue the process sleeps on
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: runs in the PIT interrupt
+ */
+static void sleep_timeout(uint32_t data) {
+    wake_up((wait_queue_t*)data);
+}
+
 /*
  * close
  *   DESCRIPTION: Deletes an existing process
@@ -460,11 +671,8 @@ int32_t sigreturn(void){
  *   SIDE EFFECTS: deletes the PCB associate with the PID
  */
 int32_t end_process(uint32_t pid) {
-	if(pid >= 6) return -1;
-
-
-	pcb_status[pid] = 0;
 	pcb_t* cur_pcb = get_pcb(pid);
+	if(cur_pcb == NULL) return -1;
 
 	//close all the files if they could be closed
 	int i;
@@ -474,6 +682,12 @@ int32_t end_process(uint32_t pid) {
 	}
 	//clear all the initialization information
 	cur_pcb->pid = -1;
+	user_space_free(cur_pcb->pg_drct);
+	cur_pcb->pg_drct = 0;
+	cur_pcb->io_ring = NULL;			// freed with the user pages
+	image_cache_put(cur_pcb->image);
+	cur_pcb->image = -1;
+	timer_del(&cur_pcb->sleep_timer);
 
 	for(i = 0; i < NUM_FILES; i++) {
 		if(cur_pcb->f_array[i].flags == 1) {
@@ -495,10 +709,90 @@ int32_t end_process(uint32_t pid) {
 	cur_pcb->ebp = 0;
 	cur_pcb->ss0 = 0;
 	//cur_pcb->arg = {0};
+	pcb_free(pid);
 
 	return 0;
 }
 
+/*
+ * load_user_page
+ *   DESCRIPTION: Demand paging for user memory, called from the page fault
+ *                handler. Allocates a frame for the faulting page of the
+ *                running process and fills it: pages covered by the program
+ *                image are read from the file system, everything else (bss,
+ *                stack) is zeroed.
+ *                Read only text pages come from the image cache, they are
+ *                loaded by the first process that touches them and mapped
+ *                read only into every other process running the program
+ *   INPUTS: vaddr--faulting virtual address
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if the fault was handled, -1 if it is a real fault
+ *   SIDE EFFECTS: maps and writes the page
+ */
+int32_t load_user_page(uint32_t vaddr) {
+	uint32_t flags, frame, shared;
+	int32_t bytes = 0;
+	uint32_t page = vaddr & ~(PAGE_4KB - 1);
+	uint32_t image_page = (page - VIRTUAL_ADDR) / PAGE_4KB;
+
+	if(vaddr < USER_BEGIN || vaddr >= USER_BEGIN + PAGE_SIZE) return -1;
+	if(terminal[processing_terminal].num_process == 0) return -1;
+	// a present page faulting is a protection violation
+	if(user_page_present(page)) return -1;
+
+	pcb_t* cur_pcb = get_pcb(terminal[processing_terminal].cur_pid);
+
+	cli_and_save(flags);
+	frame = 0;
+	if(page >= VIRTUAL_ADDR && page - VIRTUAL_ADDR < cur_pcb->exe_length) {
+		// already loaded by another instance: just map it
+		frame = image_page_frame(cur_pcb->image, image_page);
+		if(frame != 0) {
+			map_user_frame(page, frame, 0);
+			restore_flags(flags);
+			return 0;
+		}
+		frame = image_page_alloc(cur_pcb->image, image_page);
+	}
+	shared = (frame != 0);
+	if(!shared) frame = frame_alloc(0);
+	if(frame == 0) {
+		restore_flags(flags);
+		return -1;
+	}
+
+	// fill the frame through the kernel's direct mapping, then map it
+	if(page >= VIRTUAL_ADDR && page - VIRTUAL_ADDR < cur_pcb->exe_length) {
+		bytes = read_data(cur_pcb->exe_inode, page - VIRTUAL_ADDR, (uint8_t*)frame, PAGE_4KB);
+		if(bytes < 0) bytes = 0;
+	}
+	memset((uint8_t*)frame + bytes, 0, PAGE_4KB - bytes);
+	map_user_frame(page, frame, !shared);
+	restore_flags(flags);
+
+	return 0;
+}
+
+/*
+ * user_fault
+ *   DESCRIPTION: Ends the running process after a page fault it is to blame
+ *                for: one raised in user mode, or one the kernel took on a
+ *                user address while copying for a system call, e.g. a read()
+ *                into a read only text page
+ *   INPUTS: vaddr--faulting virtual address
+ *           error--error code of the page fault
+ *   OUTPUTS: none
+ *   RETURN VALUE: -1 if the fault is not the process's, never returns otherwise
+ *   SIDE EFFECTS: halts the running process
+ */
+int32_t user_fault(uint32_t vaddr, uint32_t error) {
+	if(terminal[processing_terminal].num_process == 0) return -1;
+	if(!(error & PF_USER) && (vaddr < USER_BEGIN || vaddr >= USER_BEGIN + PAGE_SIZE) && vaddr < USER_VID) return -1;
+
+	halt(FAULT_STATUS);
+	return 0;
+}
+
 /*
  * get_pcb
  *   DESCRIPTION: Gets the PCB related to teh PID
@@ -508,5 +802,76 @@ int32_t end_process(uint32_t pid) {
  *   SIDE EFFECTS: none
  */
 pcb_t* get_pcb(uint32_t pid){
-	return (pcb_t*)(KERNEL_MEM_END - KRNL_STACK_SIZE * (pid + 1)) ;
+	if(pid >= MAX_PID) return NULL;
+	return pcb_table[pid];
+}
+
+/*
+ * pcb_alloc
+ *   DESCRIPTION: Reserves a pid and the 8 KB block holding its PCB and
+ *                kernel stack. The lowest free pid is found with bsf on
+ *                the pid bitmap, the block is taken from the cache of
+ *                freed stacks or else from the frame allocator
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the new pid, -1 if pids or memory ran out
+ *   SIDE EFFECTS: get_pcb returns the block from now on
+ */
+static int32_t pcb_alloc(void) {
+	uint32_t flags, w, bit;
+	uint32_t* block;
+
+	cli_and_save(flags);
+	for(w = pid_hint; w < PID_WORDS && pid_map[w] == 0xFFFFFFFF; w++);
+	if(w == PID_WORDS) {
+		restore_flags(flags);
+		return -1;
+	}
+	if(stack_cache != NULL) {
+		block = stack_cache;
+		stack_cache = (uint32_t*)*block;
+		stack_cached--;
+	} else {
+		block = (uint32_t*)frame_alloc(STACK_ORDER);
+		if(block == NULL) {
+			restore_flags(flags);
+			return -1;
+		}
+	}
+	asm volatile("bsfl %1, %0": "=r"(bit): "r"(~pid_map[w]));
+	pid_map[w] |= (1 << bit);
+	pid_hint = w;
+	pcb_table[w*32 + bit] = (pcb_t*)block;
+	restore_flags(flags);
+
+	return w*32 + bit;
+}
+
+/*
+ * pcb_free
+ *   DESCRIPTION: Releases a pid and its PCB block. A few blocks are kept
+ *                on a free list so the next execute does not go through
+ *                the frame allocator
+ *   INPUTS: pid--process ID
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the block may still be the current kernel stack, the
+ *                 caller keeps interrupts off until it leaves it
+ */
+static void pcb_free(uint32_t pid) {
+	uint32_t flags;
+	uint32_t* block = (uint32_t*)pcb_table[pid];
+
+	cli_and_save(flags);
+	pcb_table[pid] = NULL;
+	pid_map[pid / 32] &= ~(1 << (pid % 32));
+	if(pid / 32 < pid_hint) pid_hint = pid / 32;
+	if(stack_cached < STACK_CACHE_MAX) {
+		*block = (uint32_t)stack_cache;
+		stack_cache = block;
+		stack_cached++;
+	} else {
+		frame_free((uint32_t)block, STACK_ORDER);
+	}
+	restore_flags(flags);
 }
@@ -10,9 +10,10 @@
 #include "i8259.h"
 #include "lib.h"
 #include "terminal.h"
+#include "clock.h"
+#include "timer.h"
 
 // Global Variables
-uint32_t pcb_status[6];
 //uint32_t cur_pid;
 
 void syscall_init(void);
@@ -36,6 +37,14 @@ int32_t vidmap(uint8_t** screen_start);
 int32_t set_handler(int32_t signum, void* handler_address);
 /* Signal return */
 int32_t sigreturn(void);
+/* Read the monotonic clock */
+int32_t gettime(timespec_t* ts);
+/* Sleep for a number of seconds and nanoseconds */
+int32_t nanosleep(uint32_t sec, uint32_t nsec);
+/* Map the submission and completion rings */
+int32_t io_setup(void** ring);
+/* Run the queued submissions */
+int32_t io_enter(uint32_t to_submit);
 
 // Function Pointer Definitions
 typedef int32_t (*read_t) (int32_t fd, void* buf, int32_t nbytes);
@@ -51,6 +60,37 @@ typedef struct fops_t {
 	close_t close_func;
 }fops_t;
 
+// Submission and completion rings shared with user space, one page
+#define IO_SQ_ENTRIES	64
+#define IO_CQ_ENTRIES	128
+#define IO_OP_READ		0
+#define IO_OP_WRITE		1
+
+// a request, what read or write would take
+typedef struct io_sqe_t {
+	uint32_t op;
+	int32_t fd;
+	uint32_t buf;
+	int32_t nbytes;
+	uint32_t user_data;		//copied to the completion
+} io_sqe_t;
+
+// the result of a request
+typedef struct io_cqe_t {
+	uint32_t user_data;
+	int32_t res;			//what read or write would return
+} io_cqe_t;
+
+// indices run freely and wrap at the ring size
+typedef struct io_ring_t {
+	volatile uint32_t sq_head;	//advanced by the kernel
+	volatile uint32_t sq_tail;	//advanced by user code
+	volatile uint32_t cq_head;	//advanced by user code
+	volatile uint32_t cq_tail;	//advanced by the kernel
+	io_sqe_t sqes[IO_SQ_ENTRIES];
+	io_cqe_t cqes[IO_CQ_ENTRIES];
+} io_ring_t;
+
 // FD Struct
 typedef struct fd_t{
 	fops_t fops;
@@ -69,13 +109,29 @@ typedef struct pcb_t {
 	uint32_t ebp;
 	uint16_t ss0;
 	int8_t arg[128];
-	uint32_t pd_entry;
+	uint32_t pg_drct;		//Page Directory of the process, loaded into CR3
+	uint32_t exe_inode;		//program image, paged in on demand
+	uint32_t exe_length;
+	int32_t image;			//image cache entry holding the shared text
+	uint32_t term;			//terminal the process belongs to
+	uint32_t sched_esp;		//kernel stack saved by the scheduler
+	uint32_t on_rq;			//runnable, in the run queue
+	struct pcb_t* next;		//run queue links
+	struct pcb_t* prev;
+	struct pcb_t* wait_next;	//wait queue link
+	uint32_t ticks;			//PIT ticks the process ran for
+	timer_t sleep_timer;		//wakes the process from nanosleep
+	io_ring_t* io_ring;		//ring page of io_setup, NULL if none
 }pcb_t;
 
 /* Close PCB */
 int32_t end_process(uint32_t pid);
 /* Helper Function--gets pcb given pid */
 pcb_t* get_pcb(uint32_t pid);
+/* Fill a page of user memory on its first touch */
+int32_t load_user_page(uint32_t vaddr);
+/* End the running process for a page fault it caused */
+int32_t user_fault(uint32_t vaddr, uint32_t error);
 
 #endif
 
@@ -6,12 +6,14 @@
 #include "lib.h"
 #include "types.h"
 #include "paging.h"
+#include "scheduler.h"
+#include "buddy.h"
 
 // Cursor Position
 // static int cursor_x;
 // static int cursor_y;
-// Video memory position
-static char* video_mem = (char *)VIDEO;
+// Tasks waiting in terminal_read for a line
+static wait_queue_t read_wait[NUM_TERMINAL];
 
 // Keyboard buffer
 // static uint8_t kbd_buf[KBD_BUF_LEN];
@@ -21,6 +23,37 @@ static char* video_mem = (char *)VIDEO;
 // Enter flag
 // volatile uint8_t enter;
 
+/* Text of a terminal, the window of its ring */
+static char* term_mem(int i);
+/* Move the window of a terminal to a row of its ring */
+static void set_origin(int i, int row);
+/* Draw the status bar of a terminal */
+static void draw_bar(int i);
+/* Row y of a terminal, negative rows come from the scrollback */
+static char* term_row(int i, int y);
+/* Append lines to the scrollback of a terminal */
+static void sb_push(int i, const char* rows, int n);
+/* Leave the scrollback and show the terminal again */
+static void show_live(int i);
+/* Write the CRTC start address */
+static void crtc_start(unsigned short start);
+/* Write the CRTC cursor location */
+static void crtc_cursor(unsigned short position);
+/* Length of the run of glyphs that fits in the current row */
+static int write_run(const uint8_t* buf, int len, int x);
+/* Write text without escape sequences */
+static void write_text(int j, const uint8_t *buf, int nbytes);
+/* Feed a byte to the escape sequence state machine */
+static void ansi_feed(int j, uint8_t c);
+/* Run a control sequence */
+static void ansi_csi(int j, uint8_t cmd);
+/* Apply a graphic rendition parameter */
+static void sgr(terminal_t* t, int code);
+/* Blank cells with the current attribute */
+static void erase(int j, int y, int x, int count);
+/* Scroll the scroll region by a line */
+static void region_scroll(int j);
+
 /*
  * terminal_open
  *   DESCRIPTION: Opens the terminal and initializes it
@@ -60,10 +93,23 @@ int32_t terminal_close(int32_t fd)
  */
 void terminal_init(void) {
     int i;
+    memset_word((void*)TERM_VIDEO(0), BLANK, NUM_TERMINAL*TERM_VIDEO_SIZE/2);
     for(i=0; i<NUM_TERMINAL; i++)
     {
         running_terminal = i;
-        terminal_clear();                       // Clear video memory
+        terminal[i].origin = 0;
+        terminal[i].vidmap_pid = -1;
+        draw_bar(i);
+        // scrollback is optional, the terminal works without it
+        terminal[i].sb = (char *)frame_alloc(SB_ORDER);
+        terminal[i].sb_head = 0;
+        terminal[i].sb_count = 0;
+        terminal[i].sb_view = 0;
+        terminal[i].attrib = ATTRIB;
+        terminal[i].esc_state = ESC_NONE;
+        terminal[i].esc_reverse = 0;
+        terminal[i].scroll_top = 0;
+        terminal[i].scroll_bot = NUM_ROWS - 1;
         cursor_init();                          // Initialize cursor to top of page
         clear_kbd_buf();                        // Clear keyboard buffer
         terminal[i].id = i;
@@ -73,7 +119,7 @@ void terminal_init(void) {
     }
     running_terminal = 0;
     processing_terminal = 0;
-    next_terminal = 0;
+    set_origin(0, 0);
 }
 
 /*
@@ -85,14 +131,7 @@ void terminal_init(void) {
  *   SIDE EFFECTS: none
  */
 void terminal_clear(void) {
-    int32_t j;
-    for(j=0; j<NUM_ROWS*NUM_COLS; j++) {
-        *(uint8_t *)(video_mem + (j << 1)) = ' ';
-        *(uint8_t *)(video_mem + (j << 1) + 1) = ATTRIB;
-
-        *(uint8_t *)(video_mem + (running_terminal+1)*PAGE_4KB  + (j << 1)) = ' ';
-        *(uint8_t *)(video_mem + (running_terminal+1)*PAGE_4KB  + (j << 1) + 1) = ATTRIB;
-    }
+    memset_word(term_mem(running_terminal), BLANK, NUM_ROWS*NUM_COLS);
 }
 
 /*
@@ -154,10 +193,11 @@ void terminal_getc(uint8_t c) {
  *   SIDE EFFECTS: Updates cursor
  */
 void terminal_putc(uint8_t c) {
+    show_live(running_terminal);
     //printf("%d %d, ",terminal[running_terminal].cursor_x, terminal[running_terminal].cursor_y);
     if(terminal[running_terminal].cursor_x >= NUM_COLS) {
         if(terminal[running_terminal].cursor_y == NUM_ROWS - 1) {
-            terminal_scroll_up(running_terminal);
+            terminal_scroll_up(running_terminal, 1);
             terminal[running_terminal].cursor_y--;
         }
         terminal[running_terminal].cursor_x = 0;
@@ -165,8 +205,8 @@ void terminal_putc(uint8_t c) {
     }
 
     if(terminal[running_terminal].kbd_buf_count < KBD_BUF_LEN) {
-        *(uint8_t *)(video_mem + ((NUM_COLS*terminal[running_terminal].cursor_y + terminal[running_terminal].cursor_x) << 1)) = c;
-        *(uint8_t *)(video_mem + ((NUM_COLS*terminal[running_terminal].cursor_y + terminal[running_terminal].cursor_x) << 1) + 1) = ATTRIB;
+        *(uint8_t *)(term_mem(running_terminal) + ((NUM_COLS*terminal[running_terminal].cursor_y + terminal[running_terminal].cursor_x) << 1)) = c;
+        *(uint8_t *)(term_mem(running_terminal) + ((NUM_COLS*terminal[running_terminal].cursor_y + terminal[running_terminal].cursor_x) << 1) + 1) = ATTRIB;
         terminal[running_terminal].cursor_x++;
     }
     
@@ -185,14 +225,15 @@ void terminal_putc(uint8_t c) {
  */
 void terminal_backspace(void) {
     if(terminal[running_terminal].kbd_buf_count == 0) return;
+    show_live(running_terminal);
 
     if(terminal[running_terminal].cursor_x != 0) {
         terminal[running_terminal].kbd_buf_count--;
         terminal[running_terminal].kbd_buf[terminal[running_terminal].kbd_buf_count] = '\0';
         terminal[running_terminal].cursor_x--;
 
-        *(uint8_t *)(video_mem + ((NUM_COLS*terminal[running_terminal].cursor_y + terminal[running_terminal].cursor_x) << 1)) = ' ';
-        *(uint8_t *)(video_mem + ((NUM_COLS*terminal[running_terminal].cursor_y + terminal[running_terminal].cursor_x) << 1) + 1) = ATTRIB;
+        *(uint8_t *)(term_mem(running_terminal) + ((NUM_COLS*terminal[running_terminal].cursor_y + terminal[running_terminal].cursor_x) << 1)) = ' ';
+        *(uint8_t *)(term_mem(running_terminal) + ((NUM_COLS*terminal[running_terminal].cursor_y + terminal[running_terminal].cursor_x) << 1) + 1) = ATTRIB;
     }
     else if(terminal[running_terminal].cursor_x == 0 && terminal[running_terminal].kbd_buf_count != 0) {
         terminal[running_terminal].kbd_buf_count--;
@@ -200,8 +241,8 @@ void terminal_backspace(void) {
         terminal[running_terminal].cursor_x = NUM_COLS-1;
         terminal[running_terminal].cursor_y--;
 
-        *(uint8_t *)(video_mem + ((NUM_COLS*terminal[running_terminal].cursor_y + terminal[running_terminal].cursor_x) << 1)) = ' ';
-        *(uint8_t *)(video_mem + ((NUM_COLS*terminal[running_terminal].cursor_y + terminal[running_terminal].cursor_x) << 1) + 1) = ATTRIB;
+        *(uint8_t *)(term_mem(running_terminal) + ((NUM_COLS*terminal[running_terminal].cursor_y + terminal[running_terminal].cursor_x) << 1)) = ' ';
+        *(uint8_t *)(term_mem(running_terminal) + ((NUM_COLS*terminal[running_terminal].cursor_y + terminal[running_terminal].cursor_x) << 1) + 1) = ATTRIB;
     }
 
     terminal_update_cursor(running_terminal);
@@ -218,8 +259,9 @@ void terminal_backspace(void) {
  *   SIDE EFFECTS: updates buffer, clears keyboard buffer
  */
 void terminal_enter(void) {
+    show_live(running_terminal);
     if(terminal[running_terminal].cursor_y == NUM_ROWS - 1) {
-        terminal_scroll_up(running_terminal);
+        terminal_scroll_up(running_terminal, 1);
         terminal[running_terminal].cursor_y--;
     }
     terminal[running_terminal].cursor_x = 0;
@@ -235,43 +277,81 @@ void terminal_enter(void) {
     clear_kbd_buf();
 
     terminal[running_terminal].enter = 1;
+    wake_up(&read_wait[running_terminal]);
 }
 
 /*
  * terminal_scroll_up
- *   DESCRIPTION: Screen scrolls up by shifting everything up and clearing last line
- *   INPUTS: none
+ *   DESCRIPTION: Screen scrolls up by n lines and clears the last n lines.
+ *                The lines leaving the top are appended to the scrollback.
+ *                The window just moves down the ring of the terminal, and
+ *                the CRTC start address with it when the terminal is on
+ *                screen. Once the window hits the end of the ring, or
+ *                while vidmap pins it, the rows still shown are copied
+ *                back to its start
+ *   INPUTS: j--terminal to scroll
+ *           n--number of lines
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: moves the origin and redraws the status bar
  */
-void terminal_scroll_up(int j) {
-    int32_t i;
-    if(running_terminal == j)
-    {
-        // shift up
-        for(i=0; i<(NUM_ROWS*NUM_COLS - NUM_COLS); i++) {
-            *(uint8_t *)(video_mem + (i << 1)) = *(uint8_t *)(video_mem + (i << 1) + 2*NUM_COLS);
-            *(uint8_t *)(video_mem + (i << 1) + 1) = *(uint8_t *)(video_mem + (i << 1) + 1 + 2*NUM_COLS);
-        }
-        // clear line
-        for(i = (NUM_ROWS*NUM_COLS - NUM_COLS); i < NUM_ROWS*NUM_COLS; i++) {
-            *(uint8_t *)(video_mem + (i << 1)) = ' ';
-            *(uint8_t *)(video_mem + (i << 1) + 1) = ATTRIB;
-        }
+void terminal_scroll_up(int j, int n) {
+    char* mem = term_mem(j);
+    int keep;
+
+    // lines scrolled past without being shown still go to the scrollback
+    if(n > NUM_ROWS) {
+        sb_push(j, mem, NUM_ROWS);
+        sb_push(j, NULL, n - NUM_ROWS);
+        n = NUM_ROWS;
+    } else {
+        sb_push(j, mem, n);
     }
+    keep = NUM_ROWS - n;
 
-    // shift up
-    for(i=0; i<(NUM_ROWS*NUM_COLS - NUM_COLS); i++) {
-        *(uint8_t *)((video_mem + (j+1)*PAGE_4KB) + (i << 1)) = *(uint8_t *)((video_mem + (j+1)*PAGE_4KB) + (i << 1) + 2*NUM_COLS);
-        *(uint8_t *)((video_mem + (j+1)*PAGE_4KB) + (i << 1) + 1) = *(uint8_t *)((video_mem + (j+1)*PAGE_4KB) + (i << 1) + 1 + 2*NUM_COLS);
-    }
-    // clear line
-    for(i = (NUM_ROWS*NUM_COLS - NUM_COLS); i < NUM_ROWS*NUM_COLS; i++) {
-        *(uint8_t *)((video_mem + (j+1)*PAGE_4KB) + (i << 1)) = ' ';
-        *(uint8_t *)((video_mem + (j+1)*PAGE_4KB) + (i << 1) + 1) = ATTRIB;
+    if(terminal[j].vidmap_pid == -1 && terminal[j].origin + n + SCREEN_ROWS <= TERM_ROWS) {
+        set_origin(j, terminal[j].origin + n);
+    } else {
+        memmove((void*)TERM_VIDEO(j), mem + n*ROW_BYTES, keep*ROW_BYTES);
+        set_origin(j, 0);
     }
-    
+
+    // clear lines
+    memset_word(term_mem(j) + keep*ROW_BYTES, BLANK, n*NUM_COLS);
+    draw_bar(j);
+}
+
+/*
+ * terminal_pin_origin
+ *   DESCRIPTION: Moves the screen of a terminal back to the start of its
+ *                ring, where vidmap maps it, and keeps it there until the
+ *                process that mapped it is done
+ *   INPUTS: i--terminal
+ *           pid--process calling vidmap
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: moves the origin and the cursor
+ */
+void terminal_pin_origin(int i, int pid) {
+    if(terminal[i].vidmap_pid == -1) terminal[i].vidmap_pid = pid;
+    if(terminal[i].origin == 0) return;
+    memmove((void*)TERM_VIDEO(i), term_mem(i), SCREEN_ROWS*ROW_BYTES);
+    set_origin(i, 0);
+    terminal_update_cursor(i);
+}
+
+/*
+ * terminal_unpin_origin
+ *   DESCRIPTION: Lets the screen of a terminal scroll through its ring again
+ *                when the process that pinned it for vidmap ends
+ *   INPUTS: i--terminal
+ *           pid--process ending
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void terminal_unpin_origin(int i, int pid) {
+    if(terminal[i].vidmap_pid == pid) terminal[i].vidmap_pid = -1;
 }
 
 /*
@@ -284,16 +364,12 @@ void terminal_scroll_up(int j) {
  */
 void terminal_update_cursor(int i)
 {
-    if(i!=running_terminal) return;
-    unsigned short position=(terminal[i].cursor_y*NUM_COLS) + terminal[i].cursor_x;
+    if(i!=running_terminal || terminal[i].sb_view) return;
+    // the cursor is addressed in video memory, not relative to the origin
+    unsigned short position=((term_mem(i) - (char *)VIDEO) >> 1) + (terminal[i].cursor_y*NUM_COLS) + terminal[i].cursor_x;
     //printf("%d %d, ",terminal[i].cursor_x, terminal[i].cursor_y);
 
-    // cursor LOW port to vga INDEX register
-    outb(0x0F, VGA_PORT_ADDR);
-    outb((unsigned char)(position&MASK_LAST2BYTES), VGA_PORT_DATA);
-    // cursor HIGH port to vga INDEX register
-    outb(0x0E, VGA_PORT_ADDR);
-    outb((unsigned char)((position>>8)&MASK_LAST2BYTES), VGA_PORT_DATA);
+    crtc_cursor(position);
 }
 
 /*
@@ -310,10 +386,11 @@ void terminal_update_cursor(int i)
 int32_t terminal_read(int32_t fd, uint8_t *buf, int32_t nbytes) {
     int i;
 
-    while(!terminal[processing_terminal].enter);
+    // sleep until terminal_enter hands over a line
+    cli();
+    while(!terminal[processing_terminal].enter) sleep_on(&read_wait[processing_terminal]);
     terminal[processing_terminal].enter = 0;
 
-    cli();
     if(nbytes > KBD_BUF_LEN-1) nbytes = KBD_BUF_LEN-1;
     for(i = 0; i < nbytes && terminal[processing_terminal].kbd_buf_copy[i] != '\0'; i++) {
         buf[i] = terminal[processing_terminal].kbd_buf_copy[i];
@@ -328,7 +405,10 @@ int32_t terminal_read(int32_t fd, uint8_t *buf, int32_t nbytes) {
 
 /*
  * terminal_write
- *   DESCRIPTION: Writes the content of buf to the terminal
+ *   DESCRIPTION: Writes the content of buf to the terminal. Text between
+ *                escape sequences goes out in batches, the bytes of a
+ *                sequence are fed to the escape state machine, and the
+ *                cursor is moved once at the end
  *   INPUTS: fd--file descriptor, not used
  *           buf--buffer to write onto screen
  *           nbytes--number of bytes to write
@@ -337,78 +417,292 @@ int32_t terminal_read(int32_t fd, uint8_t *buf, int32_t nbytes) {
  *   SIDE EFFECTS: updates cursor
  */
 int32_t terminal_write(int32_t fd, const uint8_t *buf, int32_t nbytes) {
-    int i = 0;
+    int j = processing_terminal;
+    int i, n;
+
+    if(nbytes <= 0) return 0;
     cli();
-    if(running_terminal == processing_terminal)
-    {
-        for (i = 0; i < nbytes; i++){
-            /* revised verison of "putc" */
-            if(buf[i] == '\n' || buf[i] == '\r') 
-            {
-                terminal[running_terminal].cursor_y += 1;
-                if(terminal[running_terminal].cursor_y >= NUM_ROWS)
-                {
-                    terminal[running_terminal].cursor_y -= 1;
-                    terminal_scroll_up(processing_terminal);
-                }
-                terminal[running_terminal].cursor_x = 0;
-                terminal_update_cursor(processing_terminal);
-            }
-            else 
-            {
-                *(uint8_t *)(video_mem + ((NUM_COLS*terminal[running_terminal].cursor_y + terminal[running_terminal].cursor_x) << 1)) = buf[i];
-                *(uint8_t *)(video_mem + ((NUM_COLS*terminal[running_terminal].cursor_y + terminal[running_terminal].cursor_x) << 1) + 1) = ATTRIB;
-                *(uint8_t *)((video_mem + (processing_terminal+1)*PAGE_4KB) + ((NUM_COLS*terminal[processing_terminal].cursor_y + terminal[processing_terminal].cursor_x) << 1)) = buf[i];
-                *(uint8_t *)((video_mem + (processing_terminal+1)*PAGE_4KB) + ((NUM_COLS*terminal[processing_terminal].cursor_y + terminal[processing_terminal].cursor_x) << 1) + 1) = ATTRIB;
-
-                terminal[running_terminal].cursor_x += 1;
-                if(terminal[running_terminal].cursor_x >= NUM_COLS){
-                    terminal[running_terminal].cursor_x = 0;
-                    terminal[running_terminal].cursor_y += 1;
-                    if(terminal[running_terminal].cursor_y >= NUM_ROWS){
-                        terminal[running_terminal].cursor_y -= 1;
-                        terminal_scroll_up(processing_terminal);
-                        }
-                    }
-                    terminal_update_cursor(processing_terminal);
-            }
+
+    for(i = 0; i < nbytes; i += n) {
+        if(terminal[j].esc_state != ESC_NONE || buf[i] == ANSI_ESC) {
+            ansi_feed(j, buf[i]);
+            n = 1;
+            continue;
         }
+        for(n = 0; i + n < nbytes && buf[i + n] != ANSI_ESC; n++);
+        write_text(j, buf + i, n);
     }
-    else
-    {
-        for (i = 0; i < nbytes; i++){
-            /* revised verison of "putc" */
-            if(buf[i] == '\n' || buf[i] == '\r') 
-            {
-                terminal[processing_terminal].cursor_y += 1;
-                if(terminal[processing_terminal].cursor_y >= NUM_ROWS)
-                {
-                    terminal[processing_terminal].cursor_y -= 1;
-                    terminal_scroll_up(processing_terminal);
-                }
-                terminal[processing_terminal].cursor_x = 0;
-                terminal_update_cursor(processing_terminal);
-            }
-            else 
-            {
-                *(uint8_t *)((video_mem + (processing_terminal+1)*PAGE_4KB) + ((NUM_COLS*terminal[processing_terminal].cursor_y + terminal[processing_terminal].cursor_x) << 1)) = buf[i];
-                *(uint8_t *)((video_mem + (processing_terminal+1)*PAGE_4KB) + ((NUM_COLS*terminal[processing_terminal].cursor_y + terminal[processing_terminal].cursor_x) << 1) + 1) = ATTRIB;
-
-                terminal[processing_terminal].cursor_x += 1;
-                if(terminal[processing_terminal].cursor_x >= NUM_COLS){
-                    terminal[processing_terminal].cursor_x = 0;
-                    terminal[processing_terminal].cursor_y += 1;
-                    if(terminal[processing_terminal].cursor_y >= NUM_ROWS){
-                        terminal[processing_terminal].cursor_y -= 1;
-                        terminal_scroll_up(processing_terminal);
-                        }
-                    }
-                    terminal_update_cursor(processing_terminal);
+
+    terminal_update_cursor(j);
+    sti();
+    return nbytes;
+}
+
+/*
+ * write_text
+ *   DESCRIPTION: Writes glyphs and line breaks at the cursor. With the
+ *                whole screen as scroll region the lines the text runs
+ *                past the bottom are counted first so the terminal scrolls
+ *                once, then the glyphs are stored a row at a time, straight
+ *                into the scrollback for rows that were scrolled past.
+ *                Inside a smaller region each line break at its bottom
+ *                scrolls the region
+ *   INPUTS: j--terminal
+ *           buf--text without escape sequences
+ *           nbytes--number of bytes to write
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: moves the cursor of the terminal, not the hardware one
+ */
+static void write_text(int j, const uint8_t *buf, int nbytes) {
+    terminal_t* t = &terminal[j];
+    uint16_t attr = t->attrib << 8;
+    uint16_t* row;
+    int full = (t->scroll_top == 0 && t->scroll_bot == NUM_ROWS - 1);
+    int i, k, n, x, y;
+
+    // pass 1: where the cursor ends up without scrolling
+    y = 0;
+    if(full) {
+        x = t->cursor_x;
+        y = t->cursor_y;
+        for(i = 0; i < nbytes; i += n) {
+            n = write_run(buf + i, nbytes - i, x);
+            x += n;
+            if(n == 0 || x >= NUM_COLS) {
+                x = 0;
+                y++;
+                if(n == 0) n = 1;           // line break
             }
         }
+        // scroll once, the rows before the new top land in the scrollback
+        y -= NUM_ROWS - 1;
+        if(y > 0) terminal_scroll_up(j, y);
+        else y = 0;
     }
-    sti();
-    return i;
+
+    // pass 2: store glyph/attribute pairs a run at a time
+    x = t->cursor_x;
+    y = t->cursor_y - y;
+    for(i = 0; i < nbytes; i += n) {
+        n = write_run(buf + i, nbytes - i, x);
+        row = (uint16_t *)term_row(j, y);
+        if(row != NULL) {
+            for(k = 0; k < n; k++) row[x + k] = attr | buf[i + k];
+        }
+        x += n;
+        if(n == 0 || x >= NUM_COLS) {
+            x = 0;
+            if(!full && y == t->scroll_bot) region_scroll(j);
+            else if(full || y < NUM_ROWS - 1) y++;
+            if(n == 0) n = 1;               // line break
+        }
+    }
+    t->cursor_x = x;
+    t->cursor_y = y;
+}
+
+/*
+ * ansi_feed
+ *   DESCRIPTION: Steps the escape sequence state machine of a terminal by
+ *                one byte. ESC [ params final runs a control sequence:
+ *                CUP (H, f), CUU/CUD/CUF/CUB (A-D), ED (J), EL (K),
+ *                SGR (m) and DECSTBM (r); anything else is dropped
+ *   INPUTS: j--terminal
+ *           c--next byte
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may move the cursor, erase or scroll the screen
+ */
+static void ansi_feed(int j, uint8_t c) {
+    terminal_t* t = &terminal[j];
+    int k;
+
+    switch(t->esc_state) {
+    case ESC_NONE:
+        t->esc_state = ESC_START;
+        return;
+    case ESC_START:
+        if(c != '[') {
+            t->esc_state = ESC_NONE;
+            return;
+        }
+        for(k = 0; k < ESC_MAX_PARAMS; k++) t->esc_param[k] = 0;
+        t->esc_nparam = 0;
+        t->esc_state = ESC_CSI;
+        return;
+    default:
+        break;
+    }
+
+    if(c == ANSI_ESC) {
+        t->esc_state = ESC_START;           // a new sequence cancels this one
+    } else if(c >= '0' && c <= '9') {
+        if(t->esc_nparam < ESC_MAX_PARAMS && t->esc_param[t->esc_nparam] < ESC_PARAM_LIMIT)
+            t->esc_param[t->esc_nparam] = t->esc_param[t->esc_nparam]*10 + (c - '0');
+    } else if(c == ';') {
+        if(t->esc_nparam < ESC_MAX_PARAMS) t->esc_nparam++;
+    } else if(c >= CSI_FINAL_MIN && c <= CSI_FINAL_MAX) {
+        if(t->esc_nparam < ESC_MAX_PARAMS) t->esc_nparam++;
+        t->esc_state = ESC_NONE;
+        ansi_csi(j, c);
+    }
+    // intermediate and private marker bytes are ignored
+}
+
+/*
+ * ansi_csi
+ *   DESCRIPTION: Runs a complete control sequence, parameters left out
+ *                take their VT100 defaults and positions are clamped to
+ *                the screen
+ *   INPUTS: j--terminal
+ *           cmd--final byte of the sequence
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may move the cursor, erase or scroll the screen
+ */
+static void ansi_csi(int j, uint8_t cmd) {
+    terminal_t* t = &terminal[j];
+    int* p = t->esc_param;
+    int n = (p[0] > 0) ? p[0] : 1;
+    int k;
+
+    switch(cmd) {
+    case 'H':
+    case 'f':
+        t->cursor_y = ((p[0] > 0) ? p[0] : 1) - 1;
+        t->cursor_x = ((p[1] > 0) ? p[1] : 1) - 1;
+        break;
+    case 'A':
+        t->cursor_y -= n;
+        break;
+    case 'B':
+        t->cursor_y += n;
+        break;
+    case 'C':
+        t->cursor_x += n;
+        break;
+    case 'D':
+        t->cursor_x -= n;
+        break;
+    case 'J':
+        if(p[0] == 0) {
+            erase(j, t->cursor_y, t->cursor_x, NUM_ROWS*NUM_COLS);
+        } else if(p[0] == 1) {
+            erase(j, 0, 0, t->cursor_y*NUM_COLS + t->cursor_x + 1);
+        } else {
+            erase(j, 0, 0, NUM_ROWS*NUM_COLS);
+        }
+        break;
+    case 'K':
+        if(p[0] == 0) {
+            erase(j, t->cursor_y, t->cursor_x, NUM_COLS - t->cursor_x);
+        } else if(p[0] == 1) {
+            erase(j, t->cursor_y, 0, t->cursor_x + 1);
+        } else {
+            erase(j, t->cursor_y, 0, NUM_COLS);
+        }
+        break;
+    case 'm':
+        for(k = 0; k < t->esc_nparam; k++) sgr(t, p[k]);
+        break;
+    case 'r':
+        n = (p[1] > 0 && p[1] <= NUM_ROWS) ? p[1] : NUM_ROWS;
+        k = (p[0] > 0) ? p[0] : 1;
+        if(k < n) {
+            t->scroll_top = k - 1;
+            t->scroll_bot = n - 1;
+            t->cursor_x = 0;
+            t->cursor_y = 0;
+        }
+        break;
+    default:
+        break;
+    }
+
+    if(t->cursor_x < 0) t->cursor_x = 0;
+    if(t->cursor_x >= NUM_COLS) t->cursor_x = NUM_COLS - 1;
+    if(t->cursor_y < 0) t->cursor_y = 0;
+    if(t->cursor_y >= NUM_ROWS) t->cursor_y = NUM_ROWS - 1;
+}
+
+/*
+ * sgr
+ *   DESCRIPTION: Applies one Select Graphic Rendition parameter to the
+ *                attribute byte of a terminal. ANSI colors are numbered
+ *                differently from the VGA palette
+ *   INPUTS: t--terminal
+ *           code--SGR parameter
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void sgr(terminal_t* t, int code) {
+    static const uint8_t vga_color[ANSI_COLORS] = {0, 4, 2, 6, 1, 5, 3, 7};
+    uint8_t a = t->attrib;
+
+    if(t->esc_reverse) a = (a << 4) | (a >> 4);
+
+    if(code == 0) {
+        a = ATTRIB;
+        t->esc_reverse = 0;
+    } else if(code == 1) {
+        a |= ATTR_BRIGHT;
+    } else if(code == 22) {
+        a &= ~ATTR_BRIGHT;
+    } else if(code == 7) {
+        t->esc_reverse = 1;
+    } else if(code == 27) {
+        t->esc_reverse = 0;
+    } else if(code >= 30 && code <= 37) {
+        a = (a & ~ATTR_FG) | vga_color[code - 30] | (a & ATTR_BRIGHT);
+    } else if(code == 39) {
+        a = (a & ~ATTR_FG) | (ATTRIB & ATTR_FG) | (a & ATTR_BRIGHT);
+    } else if(code >= 40 && code <= 47) {
+        a = (a & ~ATTR_BG) | (vga_color[code - 40] << 4);
+    } else if(code == 49) {
+        a = (a & ~ATTR_BG) | (ATTRIB & ATTR_BG);
+    } else if(code >= 90 && code <= 97) {
+        a = (a & ~ATTR_FG) | vga_color[code - 90] | ATTR_BRIGHT;
+    }
+
+    if(t->esc_reverse) a = (a << 4) | (a >> 4);
+    t->attrib = a;
+}
+
+/*
+ * erase
+ *   DESCRIPTION: Blanks cells of a terminal with its current attribute,
+ *                a count past the end of the screen stops there
+ *   INPUTS: j--terminal
+ *           y, x--first cell
+ *           count--number of cells
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void erase(int j, int y, int x, int count) {
+    int first = y*NUM_COLS + x;
+
+    if(count > NUM_ROWS*NUM_COLS - first) count = NUM_ROWS*NUM_COLS - first;
+    memset_word(term_mem(j) + (first << 1), (terminal[j].attrib << 8) | ' ', count);
+}
+
+/*
+ * region_scroll
+ *   DESCRIPTION: Scrolls the rows of the scroll region of a terminal up by
+ *                one line, nothing leaves for the scrollback
+ *   INPUTS: j--terminal
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void region_scroll(int j) {
+    terminal_t* t = &terminal[j];
+    char* top = term_mem(j) + t->scroll_top*ROW_BYTES;
+
+    memmove(top, top + ROW_BYTES, (t->scroll_bot - t->scroll_top)*ROW_BYTES);
+    erase(j, t->scroll_bot, 0, NUM_COLS);
 }
 
 /*
@@ -429,7 +723,7 @@ uint32_t terminal_gogogo(const uint8_t *buf) {
     
     if(terminal[running_terminal].cursor_y == NUM_ROWS - 1)
     {
-        terminal_scroll_up(running_terminal);
+        terminal_scroll_up(running_terminal, 1);
         terminal[running_terminal].cursor_y--;
     }
     terminal[running_terminal].cursor_x = 0;
@@ -442,7 +736,9 @@ uint32_t terminal_gogogo(const uint8_t *buf) {
 
 /*
  * terminal_switch
- *   DESCRIPTION: switch to the particular terminal
+ *   DESCRIPTION: switch to the particular terminal, every terminal keeps
+ *                writing into its own region of video memory so only the
+ *                CRTC start address and cursor move
  *   INPUTS: terminal_id --- the index of the terminal to switch to
  *   OUTPUTS: none
  *   RETURN VALUE: none
@@ -450,18 +746,48 @@ uint32_t terminal_gogogo(const uint8_t *buf) {
  */
 void terminal_switch(int terminal_id){
     if(terminal_id == running_terminal) return;
-    // copy video memory buffer
-    memcpy((void*)(VIDEO + (running_terminal+1)*PAGE_4KB), (void*) VIDEO, PAGE_4KB);
-    change_vid(running_terminal, (VIDEO + (running_terminal + 1)*PAGE_4KB) | 0x7);
-    memcpy((void*) VIDEO, (void*)(VIDEO + (terminal_id+1)*PAGE_4KB), PAGE_4KB);  
-    change_vid(terminal_id, VIDEO | 0x7);
+    terminal[running_terminal].sb_view = 0;
     // change the global variable
     running_terminal = terminal_id;
+    set_origin(terminal_id, terminal[terminal_id].origin);
     terminal_update_cursor(running_terminal);
-    bar_on();
     return;
 }
 
+/*
+ * terminal_scrollback
+ *   DESCRIPTION: Pages the terminal on screen through its scrollback. The
+ *                requested window is blitted into the console region at
+ *                VIDEO and shown there, the terminal keeps writing into
+ *                its own region meanwhile
+ *   INPUTS: lines--how many lines to go back, negative to go forward
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the CRTC start address and hides the cursor
+ */
+void terminal_scrollback(int lines) {
+    terminal_t* t = &terminal[running_terminal];
+    int k, view;
+
+    cli();
+    view = t->sb_view + lines;
+    if(view > t->sb_count) view = t->sb_count;
+    if(view <= 0) {
+        show_live(running_terminal);
+        sti();
+        return;
+    }
+
+    t->sb_view = view;
+    for(k = 0; k < NUM_ROWS; k++) {
+        memcpy((void*)(VIDEO + k*ROW_BYTES), term_row(running_terminal, k - view), ROW_BYTES);
+    }
+    memcpy((void*)(VIDEO + NUM_ROWS*ROW_BYTES), term_mem(running_terminal) + NUM_ROWS*ROW_BYTES, ROW_BYTES);
+    crtc_start(0);
+    crtc_cursor(SCREEN_ROWS*NUM_COLS);
+    sti();
+}
+
 /*
  * bar_on
  *   DESCRIPTION: show the status bar
@@ -471,8 +797,23 @@ void terminal_switch(int terminal_id){
  *   SIDE EFFECTS: none
  */
 void bar_on()
+{
+    draw_bar(running_terminal);
+}
+
+/*
+ * draw_bar
+ *   DESCRIPTION: draw the status bar under the window of a terminal, it
+ *                highlights that terminal since it is only seen with it
+ *   INPUTS: j--terminal
+ *   OUTPUTS: output status bar to video memory
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void draw_bar(int j)
 {
     int32_t i;
+    char* video_mem = term_mem(j);
     // status bar loop
     for (i = NUM_COLS * NUM_ROWS; i < NUM_COLS * (NUM_ROWS + 1); i++) {
         if (i == SPLIT_ONE || i == SPLIT_TWO) {
@@ -481,7 +822,7 @@ void bar_on()
         }else{
             // char "="
             *(uint8_t *)(video_mem + (i << 1)) = '=';
-            if (running_terminal == 0) {
+            if (j == 0) {
                 if (i < SPLIT_ONE) {
                     // two colors: 0x7, 0x8
                     *(uint8_t *)(video_mem + (i << 1) + 1) = 0x7;
@@ -489,14 +830,14 @@ void bar_on()
                     *(uint8_t *)(video_mem + (i << 1) + 1) = 0x8;
                 }
             }
-            if (running_terminal == 1) {
+            if (j == 1) {
                 if (i < SPLIT_TWO && i > SPLIT_ONE) {
                     *(uint8_t *)(video_mem + (i << 1) + 1) = 0x7;
                 }else{
                     *(uint8_t *)(video_mem + (i << 1) + 1) = 0x8;
                 }
             }
-            if (running_terminal == 2) {
+            if (j == 2) {
                 if (i > SPLIT_TWO) {
                     *(uint8_t *)(video_mem + (i << 1) + 1) = 0x7;
                 }else{
@@ -507,3 +848,153 @@ void bar_on()
     }
 }
 
+/*
+ * term_mem
+ *   DESCRIPTION: Finds the window of a terminal in its ring
+ *   INPUTS: i--terminal
+ *   OUTPUTS: none
+ *   RETURN VALUE: address of the first row of the terminal
+ *   SIDE EFFECTS: none
+ */
+static char* term_mem(int i) {
+    return (char *)(TERM_VIDEO(i) + terminal[i].origin*ROW_BYTES);
+}
+
+/*
+ * set_origin
+ *   DESCRIPTION: Moves the window of a terminal in its ring. The CRTC
+ *                scans from the window of the terminal on screen unless
+ *                it is showing its scrollback, printf follows it along
+ *   INPUTS: i--terminal
+ *           row--ring row to show at the top of the screen
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the start address registers
+ */
+static void set_origin(int i, int row) {
+    unsigned short start;
+
+    terminal[i].origin = row;
+    if(i != running_terminal) return;
+
+    set_video_mem(term_mem(i));
+    // the scrollback stays on screen until the user leaves it
+    if(terminal[i].sb_view) return;
+    start = (term_mem(i) - (char *)VIDEO) >> 1;
+    crtc_start(start);
+}
+
+/*
+ * write_run
+ *   DESCRIPTION: Measures the glyphs at the start of buf that go on the
+ *                current row, stopping at a line break or the right edge
+ *   INPUTS: buf--text to write
+ *           len--bytes left in buf
+ *           x--column of the cursor
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of glyphs, 0 if buf starts with a line break
+ *   SIDE EFFECTS: none
+ */
+static int write_run(const uint8_t* buf, int len, int x) {
+    int n;
+
+    if(len > NUM_COLS - x) len = NUM_COLS - x;
+    for(n = 0; n < len && buf[n] != '\n' && buf[n] != '\r'; n++);
+    return n;
+}
+
+/*
+ * term_row
+ *   DESCRIPTION: Finds a row of a terminal, rows above the window are
+ *                counted back through the scrollback
+ *   INPUTS: i--terminal
+ *           y--row, -1 is the last line of the scrollback
+ *   OUTPUTS: none
+ *   RETURN VALUE: address of the row, NULL if it is no longer kept
+ *   SIDE EFFECTS: none
+ */
+static char* term_row(int i, int y) {
+    terminal_t* t = &terminal[i];
+
+    if(y >= 0) return term_mem(i) + y*ROW_BYTES;
+    if(t->sb == NULL || -y > t->sb_count) return NULL;
+    return t->sb + ((t->sb_head + y + SB_LINES) % SB_LINES)*ROW_BYTES;
+}
+
+/*
+ * sb_push
+ *   DESCRIPTION: Appends lines to the scrollback ring of a terminal,
+ *                overwriting the oldest ones once it is full
+ *   INPUTS: i--terminal
+ *           rows--first line to copy, NULL for blank lines
+ *           n--number of lines
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void sb_push(int i, const char* rows, int n) {
+    terminal_t* t = &terminal[i];
+    char* dst;
+
+    if(t->sb == NULL) return;
+    if(n > SB_LINES) n = SB_LINES;
+    for(; n > 0; n--) {
+        dst = t->sb + t->sb_head*ROW_BYTES;
+        if(rows != NULL) {
+            memcpy(dst, rows, ROW_BYTES);
+            rows += ROW_BYTES;
+        } else {
+            memset_word(dst, BLANK, NUM_COLS);
+        }
+        if(++t->sb_head == SB_LINES) t->sb_head = 0;
+        if(t->sb_count < SB_LINES) t->sb_count++;
+    }
+}
+
+/*
+ * show_live
+ *   DESCRIPTION: Leaves the scrollback of a terminal, the CRTC goes back
+ *                to its window
+ *   INPUTS: i--terminal
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: moves the cursor
+ */
+static void show_live(int i) {
+    if(terminal[i].sb_view == 0) return;
+    terminal[i].sb_view = 0;
+    set_origin(i, terminal[i].origin);
+    terminal_update_cursor(i);
+}
+
+/*
+ * crtc_start
+ *   DESCRIPTION: Sets where in video memory the CRTC starts scanning
+ *   INPUTS: start--offset in characters from VIDEO
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void crtc_start(unsigned short start) {
+    outb(CRTC_START_HIGH, VGA_PORT_ADDR);
+    outb((unsigned char)((start>>8)&MASK_LAST2BYTES), VGA_PORT_DATA);
+    outb(CRTC_START_LOW, VGA_PORT_ADDR);
+    outb((unsigned char)(start&MASK_LAST2BYTES), VGA_PORT_DATA);
+}
+
+/*
+ * crtc_cursor
+ *   DESCRIPTION: Moves the hardware cursor (taken from osdev)
+ *   INPUTS: position--offset in characters from VIDEO
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void crtc_cursor(unsigned short position) {
+    // cursor LOW port to vga INDEX register
+    outb(CRTC_CURSOR_LOW, VGA_PORT_ADDR);
+    outb((unsigned char)(position&MASK_LAST2BYTES), VGA_PORT_DATA);
+    // cursor HIGH port to vga INDEX register
+    outb(CRTC_CURSOR_HIGH, VGA_PORT_ADDR);
+    outb((unsigned char)((position>>8)&MASK_LAST2BYTES), VGA_PORT_DATA);
+}
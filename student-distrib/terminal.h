@@ -19,12 +19,55 @@
 #define NUM_TERMINAL 			3
 #define SPLIT_ONE 80 * 24 + 26
 #define SPLIT_TWO 80 * 24 + 52
+#define SCREEN_ROWS             25          // text rows and the status bar
+#define ROW_BYTES               (NUM_COLS*2)
+#define TERM_VIDEO_SIZE         0x2000      // 8KB of video memory per terminal
+#define TERM_VIDEO(i)           (0xBA000 + (i)*TERM_VIDEO_SIZE)
+#define TERM_ROWS               51          // rows that fit in TERM_VIDEO_SIZE
+#define BLANK                   ((ATTRIB << 8) | ' ')
+#define CRTC_START_HIGH         0x0C
+#define CRTC_START_LOW          0x0D
+#define CRTC_CURSOR_HIGH        0x0E
+#define CRTC_CURSOR_LOW         0x0F
+#define SB_ORDER                7           // 512KB of scrollback per terminal
+#define SB_LINES                ((PAGE_4KB << SB_ORDER) / ROW_BYTES)
+#define SB_PAGE                 (NUM_ROWS / 2)
+#define ANSI_ESC                0x1B
+#define ESC_NONE                0           // escape sequence parser states
+#define ESC_START               1
+#define ESC_CSI                 2
+#define ESC_MAX_PARAMS          8
+#define ESC_PARAM_LIMIT         1000
+#define CSI_FINAL_MIN           0x40
+#define CSI_FINAL_MAX           0x7E
+#define ANSI_COLORS             8
+#define ATTR_FG                 0x0F
+#define ATTR_BG                 0xF0
+#define ATTR_BRIGHT             0x08
 
 typedef struct terminal{
 	int id;
 	// Cursor Position
 	int cursor_x;
 	int cursor_y;
+	// Ring row shown at the top of the screen
+	int origin;
+	// Process that mapped the screen with vidmap, -1 if none. The origin
+	// stays at 0 while it runs
+	int vidmap_pid;
+	// Scrollback ring, next line to write, lines kept, lines scrolled back
+	char* sb;
+	int sb_head;
+	int sb_count;
+	int sb_view;
+	// Attribute of written text, escape sequence parser, scroll region rows
+	uint8_t attrib;
+	uint8_t esc_state;
+	uint8_t esc_reverse;
+	int esc_param[ESC_MAX_PARAMS];
+	int esc_nparam;
+	int scroll_top;
+	int scroll_bot;
 	
 	// Keyboard buffer
 	uint8_t kbd_buf[KBD_BUF_LEN];
@@ -36,15 +79,11 @@ typedef struct terminal{
 	volatile uint8_t enter;
 	//process num
 	int num_process;
-	//save esp, ebp
-	uint32_t esp;
-	uint32_t ebp;
 }terminal_t;
 
 terminal_t terminal[NUM_TERMINAL];
 volatile int running_terminal;
 volatile int processing_terminal;
-volatile int next_terminal;
 
 /* Open the terminal */
 int32_t terminal_open(const uint8_t* filename);
@@ -67,7 +106,11 @@ void terminal_backspace(void);
 /* Deal with enter */
 void terminal_enter(void);
 /* Scroll up */
-void terminal_scroll_up(int i);
+void terminal_scroll_up(int i, int n);
+/* Keep the screen at the start of the ring for vidmap */
+void terminal_pin_origin(int i, int pid);
+/* Let the screen move in the ring again once pid is done */
+void terminal_unpin_origin(int i, int pid);
 /* Update cursor */
 void terminal_update_cursor(int i);
 /* Read from terminal */
@@ -78,6 +121,8 @@ int32_t terminal_write(int32_t fd, const uint8_t *buf, int32_t nbytes);
 uint32_t terminal_gogogo(const uint8_t *buf);
 /* Change terminal*/
 void terminal_switch(int terminal_id);
+/* Page through the scrollback */
+void terminal_scrollback(int lines);
 // status bar
 void bar_on();
 
@@ -0,0 +1,215 @@
+/* timer.c - hierarchical timer wheel. The first level has a slot for
+ * each of the next 64 ticks, every further level covers 64 times the
+ * span of the one below with slots as wide as a whole lower level. A
+ * timer is filed into a slot in O(1), and a slot of an upper level is
+ * spread over the level below only when the first level wraps into it,
+ * so every tick touches a single slot however many timers are pending
+ */
+
+#include "timer.h"
+#include "lib.h"
+
+// Magic Numbers
+#define WHEEL_BITS          6
+#define WHEEL_SIZE          (1 << WHEEL_BITS)   // slots per level
+#define WHEEL_MASK          (WHEEL_SIZE - 1)
+#define NUM_LEVELS          4
+#define MAX_TIMEOUT         ((1 << (WHEEL_BITS * NUM_LEVELS)) - 1)  // 2^24 ticks
+#define LEVEL_SHIFT(n)      ((n) * WHEEL_BITS)
+
+/* Lists of pending timers, one per slot of each level */
+static timer_t* wheel[NUM_LEVELS][WHEEL_SIZE];
+/* Next tick the wheel has to process */
+static uint32_t wheel_jiffies;
+/* Number of pending timers */
+static uint32_t nr_timers;
+
+/* File a timer into the slot of its expiry */
+static void enqueue(timer_t* timer);
+/* Unlink a timer from its slot */
+static void dequeue(timer_t* timer);
+/* Spread one slot of an upper level over the levels below */
+static void cascade(int level);
+
+/*
+ * timer_init
+ *   DESCRIPTION: Empties every slot of the wheel
+ *   INPUTS: now--current tick, the wheel starts processing there
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void timer_init(uint32_t now) {
+	memset(wheel, 0, sizeof(wheel));
+	wheel_jiffies = now;
+	nr_timers = 0;
+}
+
+/*
+ * timer_add
+ *   DESCRIPTION: Queues a timer to fire at a given tick. A pending timer
+ *                is moved to the new tick, a tick in the past fires on
+ *                the next one. fn and data must be set by the caller
+ *   INPUTS: timer--timer to queue
+ *           expires--tick to fire at
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void timer_add(timer_t* timer, uint32_t expires) {
+	uint32_t flags;
+
+	cli_and_save(flags);
+	if(timer_pending(timer)) dequeue(timer);
+	timer->expires = expires;
+	enqueue(timer);
+	restore_flags(flags);
+}
+
+/*
+ * timer_del
+ *   DESCRIPTION: Takes a timer out of the wheel so it does not fire
+ *   INPUTS: timer--timer to cancel, ignored if not pending
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void timer_del(timer_t* timer) {
+	uint32_t flags;
+
+	cli_and_save(flags);
+	if(timer_pending(timer)) dequeue(timer);
+	restore_flags(flags);
+}
+
+/*
+ * timer_run
+ *   DESCRIPTION: Walks the wheel up to a given tick and calls every timer
+ *                that came due, catching up if ticks were missed. Whenever
+ *                the first level wraps the next slot of each level above
+ *                is cascaded down
+ *   INPUTS: now--current tick
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called with interrupts off, callbacks run that way too
+ */
+void timer_run(uint32_t now) {
+	int level;
+	timer_t* timer;
+	timer_t** slot;
+
+	while((int32_t)(now - wheel_jiffies) >= 0) {
+		// cascade level n when every level below it has wrapped
+		for(level = 1; level < NUM_LEVELS; level++) {
+			if(wheel_jiffies & ((1 << LEVEL_SHIFT(level)) - 1)) break;
+			cascade(level);
+		}
+
+		slot = &wheel[0][wheel_jiffies & WHEEL_MASK];
+		wheel_jiffies++;
+		while((timer = *slot) != NULL) {
+			dequeue(timer);
+			timer->fn(timer->data);
+		}
+	}
+}
+
+/*
+ * timer_next
+ *   DESCRIPTION: Finds how long the PIT may stay quiet. The first level
+ *                gives the exact tick of the next expiry, past the next
+ *                cascade of an upper level only a lower bound is known
+ *                and the wheel has to run then to look again
+ *   INPUTS: now--current tick
+ *   OUTPUTS: none
+ *   RETURN VALUE: ticks from now until a timer fires or a cascade is
+ *                 due, at least 1, or 0 if no timer is pending
+ *   SIDE EFFECTS: called with interrupts off
+ */
+uint32_t timer_next(uint32_t now) {
+	uint32_t tick;
+
+	if(nr_timers == 0) return 0;
+	for(tick = wheel_jiffies; ; tick++) {
+		if((tick & WHEEL_MASK) == 0 || wheel[0][tick & WHEEL_MASK] != NULL) break;
+	}
+	if((int32_t)(tick - now) <= 0) return 1;
+	return tick - now;
+}
+
+/*
+ * enqueue
+ *   DESCRIPTION: Picks the level whose span covers the time left until a
+ *                timer expires and links it into the slot of its expiry
+ *                there. Timers beyond the top level are clamped to it
+ *   INPUTS: timer--timer with expires set
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void enqueue(timer_t* timer) {
+	int level;
+	uint32_t expires = timer->expires;
+	int32_t delta = (int32_t)(expires - wheel_jiffies);
+	timer_t** slot;
+
+	if(delta < 0) {
+		// already due, the next run picks it up
+		expires = wheel_jiffies;
+		delta = 0;
+	} else if(delta > MAX_TIMEOUT) {
+		expires = wheel_jiffies + MAX_TIMEOUT;
+		delta = MAX_TIMEOUT;
+		timer->expires = expires;
+	}
+	for(level = 0; level < NUM_LEVELS - 1; level++) {
+		if(delta < (1 << LEVEL_SHIFT(level + 1))) break;
+	}
+
+	slot = &wheel[level][(expires >> LEVEL_SHIFT(level)) & WHEEL_MASK];
+	timer->next = *slot;
+	if(*slot != NULL) (*slot)->pprev = &timer->next;
+	*slot = timer;
+	timer->pprev = slot;
+	nr_timers++;
+}
+
+/*
+ * dequeue
+ *   DESCRIPTION: Unlinks a pending timer through the link pointing at it,
+ *                the slot head or the next field of the timer before it
+ *   INPUTS: timer--pending timer
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void dequeue(timer_t* timer) {
+	*timer->pprev = timer->next;
+	if(timer->next != NULL) timer->next->pprev = timer->pprev;
+	timer->next = NULL;
+	timer->pprev = NULL;
+	nr_timers--;
+}
+
+/*
+ * cascade
+ *   DESCRIPTION: Empties the slot of a level that the wheel has just
+ *                reached and files its timers again, each lands in a
+ *                lower level now that it is closer to expiring
+ *   INPUTS: level--level to cascade, 1 or higher
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void cascade(int level) {
+	timer_t** slot = &wheel[level][(wheel_jiffies >> LEVEL_SHIFT(level)) & WHEEL_MASK];
+	timer_t* list = *slot;
+	timer_t* timer;
+
+	*slot = NULL;
+	while((timer = list) != NULL) {
+		list = timer->next;
+		nr_timers--;
+		enqueue(timer);
+	}
+}
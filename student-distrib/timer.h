@@ -0,0 +1,37 @@
+/* timer.h - kernel timers kept in a hierarchical timer wheel driven by
+ * the PIT tick
+ */
+
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include "types.h"
+
+#ifndef ASM
+
+// A pending callback, embedded in whatever waits for it and zeroed
+// before its first use
+typedef struct timer_t {
+	uint32_t expires;               // jiffies the callback runs at
+	void (*fn)(uint32_t data);      // called from the PIT interrupt
+	uint32_t data;
+	struct timer_t* next;           // next timer of the slot
+	struct timer_t** pprev;         // link pointing at this one, NULL if not pending
+} timer_t;
+
+#define timer_pending(timer)    ((timer)->pprev != NULL)
+
+/* Empty the wheel, it starts at the current tick */
+void timer_init(uint32_t now);
+/* Queue a timer to fire at a given tick, requeues it if pending */
+void timer_add(timer_t* timer, uint32_t expires);
+/* Take a timer out of the wheel */
+void timer_del(timer_t* timer);
+/* Fire every timer due up to a given tick, called from the PIT interrupt */
+void timer_run(uint32_t now);
+/* Ticks until the wheel next has work, 0 if no timer is pending */
+uint32_t timer_next(uint32_t now);
+
+#endif
+
+#endif
@@ -16,6 +16,11 @@
 #define KERNEL_TSS 0x0030
 #define KERNEL_LDT 0x0038
 
+/* SYSENTER model specific registers */
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
 /* Size of the task state segment (TSS) */
 #define TSS_SIZE 104
 
@@ -102,3 +102,48 @@ uint8_t* ece391_strrev(uint8_t* s)
    return s;
 }
 
+
+#define TIMEPAGE ((const ece391_timepage_t*)ECE391_TIME_PAGE)
+#define NS_PER_SEC 1000000000
+
+/* Timer ticks since boot, read from the time page */
+uint32_t ece391_ticks(void)
+{
+    return TIMEPAGE->jiffies;
+}
+
+/* 
+ * Same result as ece391_gettime without entering the kernel: snapshot the
+ * time page under its sequence counter, then scale the TSC.  Falls back
+ * to the system call if the kernel has not calibrated the clock.
+ */
+int32_t ece391_fastgettime(ece391_timespec_t* ts)
+{
+    uint32_t seq, mult, shift, base_lo, base_hi, lo, hi;
+    uint64_t cycles, ns;
+
+    do {
+        seq = TIMEPAGE->seq;
+        asm volatile ("" : : : "memory");
+        mult = TIMEPAGE->mult;
+        shift = TIMEPAGE->shift;
+        base_lo = TIMEPAGE->base_lo;
+        base_hi = TIMEPAGE->base_hi;
+        asm volatile ("rdtsc" : "=a" (lo), "=d" (hi) : : "memory");
+    } while ((seq & 1) || seq != TIMEPAGE->seq);
+
+    if (0 == mult)
+        return ece391_gettime (ts);
+
+    cycles = (((uint64_t)hi << 32) | lo) - (((uint64_t)base_hi << 32) | base_lo);
+    lo = (uint32_t)cycles;
+    hi = (uint32_t)(cycles >> 32);
+    ns = (((uint64_t)lo * mult) >> shift) + (((uint64_t)hi * mult) << (32 - shift));
+
+    /* 64 by 32 bit divide, there is no libgcc to do it for us */
+    asm volatile ("divl %4"
+                  : "=a" (ts->sec), "=d" (ts->nsec)
+                  : "a" ((uint32_t)ns), "d" ((uint32_t)(ns >> 32)), "r" (NS_PER_SEC)
+                  : "cc");
+    return 0;
+}
@@ -3,8 +3,63 @@
 
 #include <stdint.h>
 
+#include "ece391sysnum.h"
+
 /* All calls return >= 0 on success or -1 on failure. */
 
+/* Monotonic time since boot, filled in by ece391_gettime */
+typedef struct ece391_timespec {
+	uint32_t sec;
+	uint32_t nsec;
+} ece391_timespec_t;
+
+/* 
+ * Read only page the kernel maps into every process.  The fields are
+ * consistent while seq is even and unchanged across the reads; the clock
+ * in nanoseconds is ((tsc - base) * mult) >> shift.
+ */
+typedef struct ece391_timepage {
+	volatile uint32_t seq;
+	volatile uint32_t jiffies;
+	uint32_t hz;
+	uint32_t tsc_khz;
+	uint32_t mult;
+	uint32_t shift;
+	uint32_t base_lo;
+	uint32_t base_hi;
+	uint32_t features;      /* ECE391_FEAT_* */
+} ece391_timepage_t;
+
+/* 
+ * Submission and completion rings mapped by ece391_io_setup.  Fill
+ * sqes[sq_tail % ECE391_IO_SQ_ENTRIES] and advance sq_tail, then one
+ * ece391_io_enter runs them in order; each finished request leaves its
+ * user_data and the read/write return value in the completion ring.
+ */
+#define ECE391_IO_SQ_ENTRIES 64
+#define ECE391_IO_CQ_ENTRIES 128
+#define ECE391_IO_READ 0
+#define ECE391_IO_WRITE 1
+typedef struct ece391_io_sqe {
+	uint32_t op;
+	int32_t fd;
+	void* buf;
+	int32_t nbytes;
+	uint32_t user_data;
+} ece391_io_sqe_t;
+typedef struct ece391_io_cqe {
+	uint32_t user_data;
+	int32_t res;
+} ece391_io_cqe_t;
+typedef struct ece391_io_ring {
+	volatile uint32_t sq_head;
+	volatile uint32_t sq_tail;
+	volatile uint32_t cq_head;
+	volatile uint32_t cq_tail;
+	ece391_io_sqe_t sqes[ECE391_IO_SQ_ENTRIES];
+	ece391_io_cqe_t cqes[ECE391_IO_CQ_ENTRIES];
+} ece391_io_ring_t;
+
 /*  
  * Note that the system call for halt will have to make sure that only
  * the low byte of EBX (the status argument) is returned to the calling
@@ -21,6 +76,10 @@ extern int32_t ece391_getargs (uint8_t* buf, int32_t nbytes);
 extern int32_t ece391_vidmap (uint8_t** screen_start);
 extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
+extern int32_t ece391_gettime (ece391_timespec_t* ts);
+extern int32_t ece391_nanosleep (uint32_t sec, uint32_t nsec);
+extern int32_t ece391_io_setup (ece391_io_ring_t** ring);
+extern int32_t ece391_io_enter (uint32_t to_submit);
 
 enum signums {
 	DIV_ZERO = 0,
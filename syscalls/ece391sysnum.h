@@ -11,5 +11,14 @@
 #define SYS_VIDMAP  8
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
+#define SYS_GETTIME  11
+#define SYS_NANOSLEEP  12
+#define SYS_IO_SETUP  13
+#define SYS_IO_ENTER  14
+
+/* Read only time page, see ece391_timepage_t */
+#define ECE391_TIME_PAGE 0xFFFFF000
+#define ECE391_TIME_FEATURES (ECE391_TIME_PAGE + 32)
+#define ECE391_FEAT_SYSENTER 0x1
 
 #endif /* ECE391SYSNUM_H */